@@ -22,6 +22,8 @@
 #include <com/sun/star/io/XStream.hpp>
 #include <com/sun/star/io/XSeekable.hpp>
 
+#include "BufferPool.h"
+
 using namespace css;
 using namespace css::beans;
 using namespace css::io;
@@ -55,7 +57,8 @@ public:
     T readValue()
     {
         const sal_uInt32 nBytesToRead = sizeof(T);
-        Sequence<sal_Int8> aSequence(nBytesToRead);
+        PooledBuffer aBuffer(nBytesToRead);
+        Sequence<sal_Int8>& aSequence = aBuffer.get();
         sal_uInt32 nReadBytes = mxInputStream->readBytes(aSequence, nBytesToRead);
         if (nBytesToRead != nReadBytes)
         {
@@ -79,7 +82,8 @@ public:
     sal_Int32 readArray(char* pArray, sal_Int32 nArraySize)
     {
         const sal_uInt32 nBytesToRead = sizeof(char) * nArraySize;
-        Sequence<sal_Int8> aSequence(nBytesToRead);
+        PooledBuffer aBuffer(nBytesToRead);
+        Sequence<sal_Int8>& aSequence = aBuffer.get();
         sal_uInt32 nReadBytes = mxInputStream->readBytes(aSequence, nBytesToRead);
         memcpy(pArray, aSequence.getArray(), nReadBytes);
         return nReadBytes;
@@ -87,14 +91,16 @@ public:
 
     OString readCharArray(sal_Int32 nLength)
     {
-        Sequence<sal_Int8> aSequence(nLength);
+        PooledBuffer aBuffer(nLength);
+        Sequence<sal_Int8>& aSequence = aBuffer.get();
         sal_uInt32 nReadBytes = mxInputStream->readBytes(aSequence, nLength);
         return OString(reinterpret_cast<sal_Char*>(aSequence.getArray()), nReadBytes);
     }
 
     OUString readUnicodeArray(sal_Int32 nLength)
     {
-        Sequence<sal_Int8> aSequence(nLength * 2);
+        PooledBuffer aBuffer(nLength * 2);
+        Sequence<sal_Int8>& aSequence = aBuffer.get();
         sal_uInt32 nReadBytes = mxInputStream->readBytes(aSequence, nLength * 2);
         return OUString(reinterpret_cast<sal_Unicode*>(aSequence.getArray()), nReadBytes / 2);
     }
@@ -113,7 +119,8 @@ public:
     template <typename T>
     void writeValue(T nValue)
     {
-        Sequence<sal_Int8> aSequence(sizeof(T));
+        PooledBuffer aBuffer(sizeof(T));
+        Sequence<sal_Int8>& aSequence = aBuffer.get();
         memcpy(aSequence.getArray(), &nValue, sizeof(T));
         mxOutputStream->writeBytes(aSequence);
     }
@@ -130,14 +137,16 @@ public:
 
     void writeArray(const char * pArray, size_t nSize)
     {
-        Sequence<sal_Int8> aSequence(nSize);
+        PooledBuffer aBuffer(nSize);
+        Sequence<sal_Int8>& aSequence = aBuffer.get();
         memcpy(aSequence.getArray(), pArray, nSize);
         mxOutputStream->writeBytes(aSequence);
     }
 
     void writeUnicodeArray(const OUString & rValue)
     {
-        Sequence<sal_Int8> aSequence(rValue.getLength() * 2);
+        PooledBuffer aBuffer(rValue.getLength() * 2);
+        Sequence<sal_Int8>& aSequence = aBuffer.get();
         memcpy(aSequence.getArray(), rValue.getStr(), rValue.getLength() * 2);
         mxOutputStream->writeBytes(aSequence);
     }
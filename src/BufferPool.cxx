@@ -0,0 +1,106 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+#include "BufferPool.h"
+
+#include <rtl/alloc.h>
+
+#include <cstdlib>
+#include <iterator>
+
+#if defined(LINUX)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace css::uno;
+
+static void lcl_adviseHugePages(Sequence<sal_Int8>& rBuffer)
+{
+#if defined(LINUX) && defined(MADV_HUGEPAGE)
+    // Only whole pages inside the buffer can be advised, the sequence header shares the first one
+    const sal_uIntPtr nPageSize = sysconf(_SC_PAGESIZE);
+    sal_uIntPtr nBegin = reinterpret_cast<sal_uIntPtr>(rBuffer.getArray());
+    sal_uIntPtr nEnd = nBegin + rBuffer.getLength();
+    nBegin = (nBegin + nPageSize - 1) & ~(nPageSize - 1);
+    nEnd &= ~(nPageSize - 1);
+    if (nBegin < nEnd)
+        madvise(reinterpret_cast<void*>(nBegin), nEnd - nBegin, MADV_HUGEPAGE);
+#else
+    (void)rBuffer;
+#endif
+}
+
+BufferPool::BufferPool()
+    : mnPooledBytes(0)
+    , mbHugePages(getenv("XORENCRYPTION_HUGEPAGES") != nullptr)
+{
+}
+
+BufferPool& BufferPool::get()
+{
+    static thread_local BufferPool aPool;
+    return aPool;
+}
+
+Sequence<sal_Int8> BufferPool::acquire(sal_Int32 nSize)
+{
+    for (auto aIter = maBuffers.rbegin(); aIter != maBuffers.rend(); ++aIter)
+    {
+        if (aIter->getLength() == nSize)
+        {
+            Sequence<sal_Int8> aBuffer(*aIter);
+            maBuffers.erase(std::next(aIter).base());
+            mnPooledBytes -= nSize;
+            return aBuffer;
+        }
+    }
+
+    Sequence<sal_Int8> aBuffer(nSize);
+    if (mbHugePages && nSize >= BUFFERPOOL_HUGEPAGE_SIZE)
+        lcl_adviseHugePages(aBuffer);
+    return aBuffer;
+}
+
+void BufferPool::release(const Sequence<sal_Int8>& rBuffer)
+{
+    // Someone else still holds the bytes, so they are neither ours to wipe nor to reuse
+    if (rBuffer.get()->nRefCount > 1)
+        return;
+
+    // Chunks carry plaintext through the transforms. This is the only reference, so
+    // writing through it wipes the buffer itself rather than a copy.
+    rtl_secureZeroMemory(const_cast<sal_Int8*>(rBuffer.getConstArray()), rBuffer.getLength());
+
+    if (rBuffer.getLength() > BUFFERPOOL_MAX_BYTES)
+        return;
+
+    // Drop the least recently released buffers first, they are the odd sized tails
+    while (!maBuffers.empty()
+           && (maBuffers.size() >= BUFFERPOOL_MAX_BUFFERS
+               || mnPooledBytes + rBuffer.getLength() > BUFFERPOOL_MAX_BYTES))
+    {
+        mnPooledBytes -= maBuffers.front().getLength();
+        maBuffers.erase(maBuffers.begin());
+    }
+
+    maBuffers.push_back(rBuffer);
+    mnPooledBytes += rBuffer.getLength();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
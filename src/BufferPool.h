@@ -0,0 +1,75 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+
+#ifndef INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_BUFFERPOOL_H
+#define INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_BUFFERPOOL_H
+
+#include <com/sun/star/uno/Sequence.hxx>
+
+#include <vector>
+
+#define BUFFERPOOL_MAX_BUFFERS 64
+#define BUFFERPOOL_MAX_BYTES (64 * 1024 * 1024)
+#define BUFFERPOOL_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * Per thread cache of byte sequences.
+ *
+ * All stream I/O goes through Sequence<sal_Int8>, so instead of allocating one for
+ * every value or chunk, the stream helpers and the transform pipeline take them from
+ * here and give them back when done. Buffers are matched by exact size, as resizing
+ * a sequence reallocates it anyway. Buffers are wiped when they come back, whether
+ * they are pooled or dropped, as they may have held plaintext.
+ *
+ * Large buffers can be backed by transparent huge pages, see XORENCRYPTION_HUGEPAGES.
+ */
+class BufferPool
+{
+    std::vector< css::uno::Sequence< sal_Int8 > > maBuffers;
+    sal_Int64 mnPooledBytes;
+    bool mbHugePages;
+
+    BufferPool();
+public:
+    static BufferPool& get();
+
+    css::uno::Sequence< sal_Int8 > acquire(sal_Int32 nSize);
+    void release(const css::uno::Sequence< sal_Int8 >& rBuffer);
+};
+
+/// Borrows a buffer from the pool of the current thread for the lifetime of the object.
+class PooledBuffer
+{
+    css::uno::Sequence< sal_Int8 > maBuffer;
+public:
+    explicit PooledBuffer(sal_Int32 nSize)
+        : maBuffer(BufferPool::get().acquire(nSize))
+    { }
+
+    ~PooledBuffer()
+    {
+        BufferPool::get().release(maBuffer);
+    }
+
+    css::uno::Sequence< sal_Int8 >& get() { return maBuffer; }
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,272 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+
+#ifndef INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_DATASPACESRECORDS_H
+#define INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_DATASPACESRECORDS_H
+
+#include <rtl/ustring.hxx>
+#include <rtl/ustrbuf.hxx>
+#include <com/sun/star/uno/Sequence.hxx>
+
+#include <cstddef>
+#include <tuple>
+#include <utility>
+
+/*
+ * Compile time description of the MS-OFFCRYPTO DataSpaces structures.
+ *
+ * A record is a list of fields. The same description serializes a record, at compile
+ * time when all values are constants, and parses it back from a byte buffer without
+ * copying. All integers are little endian, as the specification requires.
+ */
+namespace dataspaces
+{
+
+/// Bounds checked cursor over a serialized record. Any failed read makes all further reads fail.
+class RecordReader
+{
+    const sal_Int8* mpData;
+    const sal_Int8* mpEnd;
+public:
+    RecordReader(const sal_Int8* pData, sal_Int32 nSize)
+        : mpData(pData)
+        , mpEnd(pData + nSize)
+    { }
+
+    explicit RecordReader(const css::uno::Sequence< sal_Int8 >& rData)
+        : RecordReader(rData.getConstArray(), rData.getLength())
+    { }
+
+    bool isValid() const { return mpData != nullptr; }
+    void invalidate() { mpData = nullptr; }
+    sal_Int32 getRemaining() const { return isValid() ? mpEnd - mpData : 0; }
+
+    const sal_Int8* take(sal_Int32 nSize)
+    {
+        if (!isValid() || nSize < 0 || getRemaining() < nSize)
+        {
+            invalidate();
+            return nullptr;
+        }
+        const sal_Int8* pData = mpData;
+        mpData += nSize;
+        return pData;
+    }
+
+    bool readUInt16(sal_uInt16& rValue)
+    {
+        const sal_uInt8* p = reinterpret_cast<const sal_uInt8*>(take(2));
+        if (!p)
+            return false;
+        rValue = static_cast<sal_uInt16>(p[0] | (p[1] << 8));
+        return true;
+    }
+
+    bool readInt32(sal_Int32& rValue)
+    {
+        const sal_uInt8* p = reinterpret_cast<const sal_uInt8*>(take(4));
+        if (!p)
+            return false;
+        rValue = static_cast<sal_Int32>(p[0] | (p[1] << 8) | (p[2] << 16) | (sal_uInt32(p[3]) << 24));
+        return true;
+    }
+};
+
+/// UTF-16LE characters of a parsed string, still pointing into the record buffer
+struct UnicodeView
+{
+    const sal_Int8* mpData;
+    sal_Int32 mnLength;
+
+    UnicodeView() : mpData(nullptr), mnLength(0) {}
+
+    sal_Unicode operator[](sal_Int32 nIndex) const
+    {
+        const sal_uInt8* p = reinterpret_cast<const sal_uInt8*>(mpData) + nIndex * 2;
+        return static_cast<sal_Unicode>(p[0] | (p[1] << 8));
+    }
+
+    bool equalsAscii(const char* pAscii) const
+    {
+        sal_Int32 i = 0;
+        for (; i < mnLength && pAscii[i]; i++)
+        {
+            if ((*this)[i] != static_cast<sal_Unicode>(pAscii[i]))
+                return false;
+        }
+        return i == mnLength && !pAscii[i];
+    }
+
+    rtl::OUString toString() const
+    {
+        rtl::OUStringBuffer aBuffer(mnLength);
+        for (sal_Int32 i = 0; i < mnLength; i++)
+            aBuffer.append((*this)[i]);
+        return aBuffer.makeStringAndClear();
+    }
+};
+
+/// 32 bit integer
+struct Int32Field
+{
+    typedef sal_Int32 View;
+
+    sal_Int32 mnValue;
+
+    constexpr sal_Int32 size() const { return 4; }
+
+    constexpr sal_Int8* serialize(sal_Int8* p) const
+    {
+        p[0] = static_cast<sal_Int8>(mnValue & 0xFF);
+        p[1] = static_cast<sal_Int8>((mnValue >> 8) & 0xFF);
+        p[2] = static_cast<sal_Int8>((mnValue >> 16) & 0xFF);
+        p[3] = static_cast<sal_Int8>((mnValue >> 24) & 0xFF);
+        return p + 4;
+    }
+
+    static void parse(RecordReader& rReader, View& rView) { rReader.readInt32(rView); }
+};
+
+/// UNICODE-LP-P4 (MS-OFFCRYPTO 2.1.2): byte length, UTF-16 characters, padding to four bytes.
+/// Only ASCII names occur in the DataSpaces streams, so the value is kept as an ASCII literal.
+struct UnicodeField
+{
+    typedef UnicodeView View;
+
+    const char* mpAscii;
+    sal_Int32 mnLength;
+
+    static constexpr sal_Int32 paddedSize(sal_Int32 nLength) { return 4 + nLength * 2 + nLength * 2 % 4; }
+
+    constexpr sal_Int32 size() const { return paddedSize(mnLength); }
+
+    constexpr sal_Int8* serialize(sal_Int8* p) const
+    {
+        p = Int32Field{ mnLength * 2 }.serialize(p);
+        for (sal_Int32 i = 0; i < mnLength; i++)
+        {
+            *p++ = static_cast<sal_Int8>(mpAscii[i]);
+            *p++ = 0;
+        }
+        for (sal_Int32 i = 0; i < mnLength * 2 % 4; i++) // Padding
+            *p++ = 0;
+        return p;
+    }
+
+    static void parse(RecordReader& rReader, View& rView)
+    {
+        sal_Int32 nBytes = 0;
+        if (!rReader.readInt32(nBytes) || nBytes % 2)
+        {
+            rReader.invalidate();
+            return;
+        }
+        rView.mpData = rReader.take(nBytes);
+        rView.mnLength = nBytes / 2;
+        rReader.take(nBytes % 4);
+    }
+};
+
+constexpr Int32Field int32(sal_Int32 nValue) { return Int32Field{ nValue }; }
+
+constexpr sal_Int32 asciiLength(const char* pAscii)
+{
+    sal_Int32 nLength = 0;
+    while (pAscii[nLength])
+        nLength++;
+    return nLength;
+}
+
+constexpr UnicodeField unicode(const char* pAscii)
+{
+    return UnicodeField{ pAscii, asciiLength(pAscii) };
+}
+
+template <typename... Fields> class Record
+{
+    std::tuple<Fields...> maFields;
+
+    template <std::size_t... I> constexpr sal_Int32 sizeImpl(std::index_sequence<I...>) const
+    {
+        const sal_Int32 aSizes[] = { 0, std::get<I>(maFields).size()... };
+        sal_Int32 nSize = 0;
+        for (std::size_t i = 0; i < sizeof(aSizes) / sizeof(aSizes[0]); i++)
+            nSize += aSizes[i];
+        return nSize;
+    }
+
+    template <std::size_t... I> constexpr sal_Int8* serializeImpl(sal_Int8* p, std::index_sequence<I...>) const
+    {
+        // Braced initializers are evaluated in order
+        sal_Int8* aCursor[] = { p, (p = std::get<I>(maFields).serialize(p))... };
+        return aCursor[sizeof...(I)];
+    }
+
+    template <std::size_t... I> static void parseImpl(RecordReader& rReader, std::tuple<typename Fields::View...>& rView, std::index_sequence<I...>)
+    {
+        const int aDummy[] = { 0, (Fields::parse(rReader, std::get<I>(rView)), 0)... };
+        (void)aDummy;
+    }
+
+public:
+    typedef std::tuple<typename Fields::View...> View;
+
+    constexpr explicit Record(Fields... aFields) : maFields(aFields...) {}
+
+    constexpr sal_Int32 size() const { return sizeImpl(std::index_sequence_for<Fields...>()); }
+
+    constexpr sal_Int8* serialize(sal_Int8* p) const
+    {
+        return serializeImpl(p, std::index_sequence_for<Fields...>());
+    }
+
+    /// Field values of a record; strings point into the reader's buffer
+    static bool parse(RecordReader& rReader, View& rView)
+    {
+        parseImpl(rReader, rView, std::index_sequence_for<Fields...>());
+        return rReader.isValid();
+    }
+};
+
+template <typename... Fields> constexpr Record<Fields...> makeRecord(Fields... aFields)
+{
+    return Record<Fields...>(aFields...);
+}
+
+/// Serialized form of a constant record, computed by the compiler
+template <sal_Int32 N> struct RecordBytes
+{
+    sal_Int8 maData[N];
+
+    const char* getData() const { return reinterpret_cast<const char*>(maData); }
+    constexpr sal_Int32 size() const { return N; }
+};
+
+template <sal_Int32 N, typename R> constexpr RecordBytes<N> toBytes(const R& rRecord)
+{
+    RecordBytes<N> aBytes{};
+    rRecord.serialize(aBytes.maData);
+    return aBytes;
+}
+
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
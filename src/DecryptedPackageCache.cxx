@@ -0,0 +1,90 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+#include "DecryptedPackageCache.h"
+
+#include <rtl/alloc.h>
+
+#include <cstdlib>
+#include <cstring>
+
+DecryptedPackageCache::DecryptedPackageCache()
+    : mnBytes(0)
+    , mnMaxBytes(0)
+{
+    if (const char* pMegabytes = getenv("XORENCRYPTION_DECRYPTCACHE_MB"))
+        mnMaxBytes = sal_Int64(atoi(pMegabytes)) * 1024 * 1024;
+}
+
+DecryptedPackageCache& DecryptedPackageCache::get()
+{
+    static DecryptedPackageCache* pCache = new DecryptedPackageCache();
+    return *pCache;
+}
+
+DecryptedPackageCache::Package DecryptedPackageCache::wrap(std::vector<sal_Int8>* pData)
+{
+    return Package(pData, [](const std::vector<sal_Int8>* pPackage) {
+        std::vector<sal_Int8>* pWiped = const_cast<std::vector<sal_Int8>*>(pPackage);
+        rtl_secureZeroMemory(pWiped->data(), pWiped->size());
+        delete pWiped;
+    });
+}
+
+DecryptedPackageCache::Package DecryptedPackageCache::lookup(const sal_uInt8* pDigest)
+{
+    std::lock_guard<std::mutex> aGuard(maMutex);
+    for (auto aIter = maEntries.begin(); aIter != maEntries.end(); ++aIter)
+    {
+        if (memcmp(aIter->aDigest, pDigest, RTL_DIGEST_LENGTH_SHA1) == 0)
+        {
+            maEntries.splice(maEntries.begin(), maEntries, aIter);
+            return aIter->pPackage;
+        }
+    }
+    return Package();
+}
+
+void DecryptedPackageCache::insert(const sal_uInt8* pDigest, const Package& rPackage)
+{
+    const sal_Int64 nSize = rPackage->size();
+    if (nSize > mnMaxBytes)
+        return;
+
+    std::lock_guard<std::mutex> aGuard(maMutex);
+    for (const auto& rEntry : maEntries)
+    {
+        // Opened twice at the same time
+        if (memcmp(rEntry.aDigest, pDigest, RTL_DIGEST_LENGTH_SHA1) == 0)
+            return;
+    }
+
+    while (!maEntries.empty() && mnBytes + nSize > mnMaxBytes)
+    {
+        mnBytes -= maEntries.back().pPackage->size();
+        maEntries.pop_back();
+    }
+
+    Entry aEntry;
+    memcpy(aEntry.aDigest, pDigest, RTL_DIGEST_LENGTH_SHA1);
+    aEntry.pPackage = rPackage;
+    maEntries.push_front(aEntry);
+    mnBytes += nSize;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
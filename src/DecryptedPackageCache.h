@@ -0,0 +1,74 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+
+#ifndef INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_DECRYPTEDPACKAGECACHE_H
+#define INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_DECRYPTEDPACKAGECACHE_H
+
+#include <rtl/digest.h>
+#include <sal/types.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Decrypted packages of recently opened documents, keyed by a digest of the key and
+ * the encrypted bytes. Opening the same encrypted file again copies the package from
+ * here instead of transforming it. The cache owns the plaintext, it is never shared
+ * with a Sequence handed out to the filters.
+ *
+ * Off unless XORENCRYPTION_DECRYPTCACHE_MB sets a budget in megabytes. Least recently
+ * used packages are evicted first, and their memory is wiped once the last reader of
+ * the package is done with it.
+ */
+class DecryptedPackageCache
+{
+public:
+    typedef std::shared_ptr< const std::vector< sal_Int8 > > Package;
+
+private:
+    struct Entry
+    {
+        sal_uInt8 aDigest[RTL_DIGEST_LENGTH_SHA1];
+        Package pPackage;
+    };
+
+    std::mutex maMutex;
+    std::list< Entry > maEntries; // most recently used first
+    sal_Int64 mnBytes;
+    sal_Int64 mnMaxBytes;
+
+    DecryptedPackageCache();
+public:
+    static DecryptedPackageCache& get();
+
+    bool isEnabled() const { return mnMaxBytes > 0; }
+    sal_Int64 getMaxBytes() const { return mnMaxBytes; }
+
+    /// The buffer is wiped when the last Package referring to it goes away
+    static Package wrap(std::vector< sal_Int8 >* pData);
+
+    Package lookup(const sal_uInt8* pDigest);
+    void insert(const sal_uInt8* pDigest, const Package& rPackage);
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,150 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+#include "KeyDerivation.h"
+
+#include <rtl/alloc.h>
+
+#include <chrono>
+#include <cstring>
+
+using namespace css::uno;
+
+// The key is wiped when the last reference to it goes away
+static std::shared_ptr<const std::vector<sal_Int8>> lcl_pbkdf2(const rtl::OString& rPassword, const Sequence<sal_Int8>& rSalt,
+                                                               sal_Int32 nIterations)
+{
+    std::vector<sal_Int8>* pKey = new std::vector<sal_Int8>(RTL_DIGEST_LENGTH_SHA1);
+    std::shared_ptr<const std::vector<sal_Int8>> aKey(pKey, [](const std::vector<sal_Int8>* pWiped) {
+        rtl_secureZeroMemory(const_cast<sal_Int8*>(pWiped->data()), pWiped->size());
+        delete pWiped;
+    });
+    rtl_digest_PBKDF2(reinterpret_cast<sal_uInt8*>(pKey->data()), pKey->size(),
+                      reinterpret_cast<const sal_uInt8*>(rPassword.getStr()), rPassword.getLength(),
+                      reinterpret_cast<const sal_uInt8*>(rSalt.getConstArray()), rSalt.getLength(),
+                      nIterations);
+    return aKey;
+}
+
+namespace
+{
+// Joins the prefetch threads when the library is unloaded, they must not outlive the code they run
+struct PrefetchJoiner
+{
+    DerivedKeyCache* mpCache;
+
+    explicit PrefetchJoiner(DerivedKeyCache* pCache) : mpCache(pCache) {}
+    ~PrefetchJoiner() { mpCache->joinPrefetches(); }
+};
+}
+
+DerivedKeyCache& DerivedKeyCache::get()
+{
+    static DerivedKeyCache* pCache = new DerivedKeyCache();
+    static PrefetchJoiner aJoiner(pCache);
+    return *pCache;
+}
+
+std::shared_future<DerivedKeyCache::Key> DerivedKeyCache::find(const rtl::OUString& rPassword, const Sequence<sal_Int8>& rSalt,
+                                                              sal_Int32 nIterations, bool bBackground)
+{
+    const rtl::OString aPassword = rtl::OUStringToOString(rPassword, RTL_TEXTENCODING_UTF8);
+
+    // The cache is looked up by a digest, it never holds the password
+    sal_uInt8 aId[RTL_DIGEST_LENGTH_SHA1];
+    rtlDigest aDigest = rtl_digest_create(rtl_Digest_AlgorithmSHA1);
+    rtl_digest_update(aDigest, &nIterations, sizeof(nIterations));
+    rtl_digest_update(aDigest, rSalt.getConstArray(), rSalt.getLength());
+    rtl_digest_update(aDigest, aPassword.getStr(), aPassword.getLength());
+    rtl_digest_get(aDigest, aId, sizeof(aId));
+    rtl_digest_destroy(aDigest);
+
+    std::shared_future<Key> aKey;
+    std::packaged_task<Key()> aTask;
+    {
+        std::lock_guard<std::mutex> aGuard(maMutex);
+        for (auto aIter = maEntries.begin(); aIter != maEntries.end(); ++aIter)
+        {
+            if (memcmp(aIter->aId, aId, sizeof(aId)) == 0)
+            {
+                maEntries.splice(maEntries.begin(), maEntries, aIter);
+                return aIter->aKey;
+            }
+        }
+
+        aTask = std::packaged_task<Key()>(
+            [aPassword, rSalt, nIterations]() { return lcl_pbkdf2(aPassword, rSalt, nIterations); });
+        aKey = aTask.get_future().share();
+
+        Entry aEntry;
+        memcpy(aEntry.aId, aId, sizeof(aId));
+        aEntry.aKey = aKey;
+        maEntries.push_front(aEntry);
+        if (maEntries.size() > KEY_DERIVATION_CACHE_SIZE)
+            maEntries.pop_back();
+    }
+
+    // Others asking for the same key meanwhile wait on the future
+    if (bBackground)
+    {
+        std::lock_guard<std::mutex> aGuard(maMutex);
+        for (auto aIter = maPrefetches.begin(); aIter != maPrefetches.end();)
+        {
+            // The key is set just before the thread returns
+            if (aIter->aKey.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            {
+                aIter->aThread.join();
+                aIter = maPrefetches.erase(aIter);
+            }
+            else
+                ++aIter;
+        }
+
+        Prefetch aPrefetch;
+        aPrefetch.aKey = aKey;
+        aPrefetch.aThread = std::thread(std::move(aTask));
+        maPrefetches.push_back(std::move(aPrefetch));
+    }
+    else
+        aTask();
+    return aKey;
+}
+
+Sequence<sal_Int8> DerivedKeyCache::derive(const rtl::OUString& rPassword, const Sequence<sal_Int8>& rSalt, sal_Int32 nIterations)
+{
+    const Key pKey = find(rPassword, rSalt, nIterations, false).get();
+    return Sequence<sal_Int8>(pKey->data(), pKey->size());
+}
+
+void DerivedKeyCache::prefetch(const rtl::OUString& rPassword, const Sequence<sal_Int8>& rSalt, sal_Int32 nIterations)
+{
+    find(rPassword, rSalt, nIterations, true);
+}
+
+void DerivedKeyCache::joinPrefetches()
+{
+    std::list<Prefetch> aPrefetches;
+    {
+        std::lock_guard<std::mutex> aGuard(maMutex);
+        aPrefetches.swap(maPrefetches);
+    }
+    for (auto& rPrefetch : aPrefetches)
+        rPrefetch.aThread.join();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
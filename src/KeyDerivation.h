@@ -0,0 +1,85 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+
+#ifndef INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_KEYDERIVATION_H
+#define INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_KEYDERIVATION_H
+
+#include <rtl/digest.h>
+#include <rtl/ustring.hxx>
+#include <com/sun/star/uno/Sequence.hxx>
+
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define KEY_DERIVATION_ITERATIONS 100000
+#define KEY_DERIVATION_CACHE_SIZE 32
+
+/**
+ * PBKDF2 (HMAC-SHA1) keys, derived once per password and salt.
+ *
+ * Derivation is slow on purpose. A document keeps its salt between saves (see the
+ * KeySalt encryption option), so autosave and repeated saves find the key here.
+ * prefetch() starts the derivation on a thread of its own: the service does that
+ * when a document is opened, for the salt its next save will use. Those threads are
+ * joined once they are done, and all of them when the library is unloaded.
+ *
+ * The cache owns its keys and wipes them once they are evicted and no derivation
+ * waits for them any more.
+ */
+class DerivedKeyCache
+{
+    typedef std::shared_ptr< const std::vector< sal_Int8 > > Key;
+
+    struct Entry
+    {
+        sal_uInt8 aId[RTL_DIGEST_LENGTH_SHA1];
+        std::shared_future< Key > aKey;
+    };
+
+    struct Prefetch
+    {
+        std::thread aThread;
+        std::shared_future< Key > aKey;
+    };
+
+    std::mutex maMutex;
+    std::list< Entry > maEntries; // most recently used first
+    std::list< Prefetch > maPrefetches; // guarded by maMutex
+
+    DerivedKeyCache() {}
+    std::shared_future< Key > find(const rtl::OUString& rPassword, const css::uno::Sequence< sal_Int8 >& rSalt,
+                                   sal_Int32 nIterations, bool bBackground);
+public:
+    static DerivedKeyCache& get();
+
+    /// Key for password and salt, waits for a derivation already running in the background
+    css::uno::Sequence< sal_Int8 > derive(const rtl::OUString& rPassword, const css::uno::Sequence< sal_Int8 >& rSalt,
+                                          sal_Int32 nIterations);
+    void prefetch(const rtl::OUString& rPassword, const css::uno::Sequence< sal_Int8 >& rSalt, sal_Int32 nIterations);
+    /// Waits for every prefetch still running
+    void joinPrefetches();
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
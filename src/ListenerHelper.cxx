@@ -21,29 +21,260 @@
 
 #include "ListenerHelper.h"
 
+#include <com/sun/star/awt/AsyncCallback.hpp>
+#include <com/sun/star/awt/XCallback.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using com::sun::star::frame::FrameActionEvent;
+using com::sun::star::frame::FrameAction_COMPONENT_DETACHING;
 using com::sun::star::frame::XFrame;
+using com::sun::star::frame::XFrameActionListener;
 using com::sun::star::frame::XDispatch;
 using com::sun::star::frame::XStatusListener;
 using com::sun::star::lang::EventObject;
+using com::sun::star::awt::AsyncCallback;
+using com::sun::star::awt::XCallback;
+using com::sun::star::awt::XRequestCallback;
+using com::sun::star::uno::Any;
+using com::sun::star::uno::Exception;
 using com::sun::star::uno::Reference;
+using com::sun::star::uno::WeakReference;
+using com::sun::star::uno::XComponentContext;
 using com::sun::star::uno::RuntimeException;
+using com::sun::star::uno::UNO_QUERY;
+using com::sun::star::uno::XInterface;
 using com::sun::star::frame::FeatureStateEvent;
 
 static AllListeners aListeners;
+// Guards aListeners. Never held while calling into UNO: identities are worked out and weak
+// references upgraded outside of it, and references taken out of the registry are released
+// after unlocking. Copying a reference under the lock only acquires it.
+static std::mutex aListenersMutex;
+
+static XInterface* lcl_getIdentity( const Reference < XFrame >& xFrame )
+{
+    return Reference < XInterface >( xFrame, UNO_QUERY ).get();
+}
+
+// Whether pFrame has an item, drops an item whose frame died without being disposed.
+// Called without aListenersMutex.
+static bool lcl_isRegistered( XInterface* pFrame )
+{
+    WeakReference < XFrame > xFrame;
+    Reference < XFrameActionListener > xFrameListener;
+    {
+        std::lock_guard < std::mutex > aGuard( aListenersMutex );
+        AllListeners::iterator aItem = aListeners.find( pFrame );
+        if ( aItem == aListeners.end() )
+            return false;
+        xFrame = aItem->second.xFrame;
+        xFrameListener = aItem->second.xFrameListener;
+    }
+    if ( lcl_getIdentity( xFrame ) == pFrame )
+        return true;
+
+    ListenerItem aStale;
+    {
+        std::lock_guard < std::mutex > aGuard( aListenersMutex );
+        AllListeners::iterator aItem = aListeners.find( pFrame );
+        // Unless AddDispatch registered a new frame under that key meanwhile
+        if ( aItem != aListeners.end() && aItem->second.xFrameListener.get() == xFrameListener.get() )
+        {
+            aStale = aItem->second;
+            aListeners.erase( aItem );
+        }
+    }
+    return false;
+}
+
+namespace
+{
+
+// Events waiting for the main thread, the last one per frame and command. A timer thread
+// waits NOTIFY_COALESCE_MS after the first event of a round, then has AsyncCallback call
+// notify() on the main thread, which delivers the round.
+class NotificationQueue : public cppu::WeakImplHelper1 < XCallback >
+{
+    struct Pending
+    {
+        WeakReference < XFrame > xFrame;
+        ::rtl::OUString aCommand;
+        FeatureStateEvent aEvent;
+    };
+
+    std::mutex maMutex;
+    std::condition_variable maCondition;
+    std::vector < Pending > maPending;
+    std::map < std::pair < XInterface*, ::rtl::OUString >, size_t > maPendingIndex;
+    Reference < XRequestCallback > mxCallback;
+    bool mbArmed;
+    sal_uInt64 mnRounds;
+    bool mbStopping;
+    std::thread maTimer;
+
+    NotificationQueue() : mbArmed( false ), mnRounds( 0 ), mbStopping( false ) {}
+
+    void runTimer()
+    {
+        sal_uInt64 nHandledRounds = 0;
+        for (;;)
+        {
+            Reference < XRequestCallback > xCallback;
+            {
+                std::unique_lock < std::mutex > aGuard( maMutex );
+                maCondition.wait( aGuard, [&] { return mnRounds != nHandledRounds || mbStopping; } );
+                if ( mbStopping
+                     || maCondition.wait_for( aGuard, std::chrono::milliseconds( NOTIFY_COALESCE_MS ),
+                                              [&] { return mbStopping; } ) )
+                    return;
+                nHandledRounds = mnRounds;
+                xCallback = mxCallback;
+            }
+            try
+            {
+                xCallback->addCallback( this, Any() );
+            }
+            catch ( const Exception& )
+            {
+                // E.g. while the office shuts down. The events stay queued for the next round.
+                std::lock_guard < std::mutex > aGuard( maMutex );
+                mbArmed = false;
+            }
+        }
+    }
+
+    // Stops and joins the timer thread when the library is unloaded, it must not outlive the code it runs
+    struct TimerStopper
+    {
+        NotificationQueue* mpQueue;
+
+        explicit TimerStopper( NotificationQueue* pQueue ) : mpQueue( pQueue ) {}
+        ~TimerStopper() { mpQueue->stop(); }
+    };
+
+public:
+    static NotificationQueue& get()
+    {
+        // Never released: AsyncCallback may still hold it when the library is unloaded
+        static NotificationQueue* pQueue = new NotificationQueue();
+        static Reference < XCallback >* pKeepAlive = new Reference < XCallback >( pQueue );
+        static TimerStopper aStopper( pQueue );
+        (void)pKeepAlive;
+        return *pQueue;
+    }
+
+    void stop()
+    {
+        std::thread aTimer;
+        {
+            std::lock_guard < std::mutex > aGuard( maMutex );
+            mbStopping = true;
+            std::swap( aTimer, maTimer );
+        }
+        maCondition.notify_one();
+        if ( aTimer.joinable() )
+            aTimer.join();
+    }
+
+    // Returns false if events can not be delivered later, the caller notifies right away then
+    bool post( const Reference < XComponentContext >& xContext, const Reference < XFrame >& xFrame,
+               const ::rtl::OUString& aCommand, const FeatureStateEvent& rEvent )
+    {
+        XInterface* pFrame = lcl_getIdentity( xFrame );
+        {
+            std::lock_guard < std::mutex > aGuard( maMutex );
+            if ( mbStopping )
+                return false;
+            if ( !mxCallback.is() )
+            {
+                try
+                {
+                    mxCallback = AsyncCallback::create( xContext );
+                }
+                catch ( const Exception& )
+                {
+                    return false;
+                }
+            }
+
+            Pending aPending;
+            aPending.xFrame = xFrame;
+            aPending.aCommand = aCommand;
+            aPending.aEvent = rEvent;
+            auto aInserted = maPendingIndex.insert( std::make_pair( std::make_pair( pFrame, aCommand ), maPending.size() ) );
+            if ( aInserted.second )
+                maPending.push_back( aPending );
+            else
+                maPending[aInserted.first->second] = aPending;
+
+            if ( mbArmed )
+                return true;
+            mbArmed = true;
+            ++mnRounds;
+            if ( !maTimer.joinable() )
+            {
+                // The thread holds a reference of its own to the queue it runs for
+                Reference < XCallback > xQueue( this );
+                maTimer = std::thread( [this, xQueue]() { runTimer(); } );
+            }
+        }
+        maCondition.notify_one();
+        return true;
+    }
+
+    // XCallback, on the main thread
+    virtual void SAL_CALL notify( const Any& )
+    {
+        std::vector < Pending > aPending;
+        {
+            std::lock_guard < std::mutex > aGuard( maMutex );
+            aPending.swap( maPending );
+            maPendingIndex.clear();
+            mbArmed = false;
+        }
+
+        ListenerHelper aHelper;
+        for ( auto& rPending : aPending )
+        {
+            Reference < XFrame > xFrame( rPending.xFrame );
+            if ( xFrame.is() )
+                aHelper.Notify( xFrame, rPending.aCommand, rPending.aEvent );
+        }
+    }
+};
+
+}
 
 void ListenerHelper::AddListener(
     const Reference < XFrame >& xFrame,
     const Reference < XStatusListener > xControl,
     const ::rtl::OUString& aCommand )
 {
-    sal_uInt32 i=0;
-    sal_uInt32 nSize = aListeners.size();
-    for ( i=0; i<nSize; i++ )
-        if ( aListeners[i].xFrame == xFrame )
-            break;
-
-    OSL_ENSURE( i<nSize, "No dispatch found for this listener!" );
-    aListeners[i].aContainer[aCommand].push_back( xControl );
+    XInterface* pFrame = lcl_getIdentity( xFrame );
+    const bool bRegistered = lcl_isRegistered( pFrame );
+    OSL_ENSURE( bRegistered, "No dispatch found for this listener!" );
+    if ( !bRegistered )
+        return;
+
+    StatusListenersSnapshot pReplaced; // Released after the lock
+    std::lock_guard < std::mutex > aGuard( aListenersMutex );
+    AllListeners::iterator aItem = aListeners.find( pFrame );
+    if ( aItem == aListeners.end() )
+        return;
+
+    StatusListenersSnapshot& rListeners = aItem->second.aContainer[aCommand];
+    std::shared_ptr < StatusListeners > pListeners = rListeners
+        ? std::make_shared < StatusListeners >( *rListeners )
+        : std::make_shared < StatusListeners >();
+    pListeners->push_back( xControl );
+    pReplaced = rListeners;
+    rListeners = pListeners;
 }
 
 void ListenerHelper::RemoveListener(
@@ -51,24 +282,24 @@ void ListenerHelper::RemoveListener(
     const Reference < XStatusListener > xControl,
     const ::rtl::OUString& aCommand )
 {
-    sal_uInt32 nSize = aListeners.size();
-    for ( sal_uInt32 i=0; i<nSize; i++ )
-    {
-        if ( aListeners[i].xFrame == xFrame )
-        {
-            StatusListeners& aL = aListeners[i].aContainer[aCommand];
-            StatusListeners::iterator aIter = aL.begin();
-            while ( aIter != aL.end() )
-            {
-                if ( (*aIter) == xControl )
-                {
-                    aL.erase( aIter );
-                    break;
-                }
+    XInterface* pFrame = lcl_getIdentity( xFrame );
+    StatusListenersSnapshot pReplaced; // Released after the lock
+    std::lock_guard < std::mutex > aGuard( aListenersMutex );
+    AllListeners::iterator aItem = aListeners.find( pFrame );
+    if ( aItem == aListeners.end() )
+        return;
 
-                ++aIter;
-            }
-        }
+    ListenerMap::iterator aCommandListeners = aItem->second.aContainer.find( aCommand );
+    if ( aCommandListeners == aItem->second.aContainer.end() || !aCommandListeners->second )
+        return;
+
+    std::shared_ptr < StatusListeners > pListeners = std::make_shared < StatusListeners >( *aCommandListeners->second );
+    StatusListeners::iterator aIter = std::find( pListeners->begin(), pListeners->end(), xControl );
+    if ( aIter != pListeners->end() )
+    {
+        pListeners->erase( aIter );
+        pReplaced = aCommandListeners->second;
+        aCommandListeners->second = pListeners;
     }
 }
 
@@ -77,33 +308,58 @@ void ListenerHelper::Notify(
         const ::rtl::OUString& aCommand,
         FeatureStateEvent& rEvent )
 {
-    sal_uInt32 nSize = aListeners.size();
-    for ( sal_uInt32 i=0; i<nSize; i++ )
+    XInterface* pFrame = lcl_getIdentity( xFrame );
+    if ( !lcl_isRegistered( pFrame ) )
+        return;
+
+    Reference < XDispatch > xDispatch;
+    StatusListenersSnapshot pListeners;
     {
-        if ( aListeners[i].xFrame == xFrame )
-        {
-            rEvent.Source = aListeners[i].xDispatch;
-            StatusListeners& aL = aListeners[i].aContainer[aCommand];
-            StatusListeners::iterator aIter = aL.begin();
-            while ( aIter != aL.end() )
-            {
-                (*aIter)->statusChanged( rEvent );
-                ++aIter;
-            }
-        }
+        std::lock_guard < std::mutex > aGuard( aListenersMutex );
+        AllListeners::iterator aItem = aListeners.find( pFrame );
+        if ( aItem == aListeners.end() )
+            return;
+
+        xDispatch = aItem->second.xDispatch;
+        ListenerMap::iterator aCommandListeners = aItem->second.aContainer.find( aCommand );
+        if ( aCommandListeners != aItem->second.aContainer.end() )
+            pListeners = aCommandListeners->second;
+    }
+
+    rEvent.Source = xDispatch;
+    if ( !pListeners )
+        return;
+
+    StatusListeners::const_iterator aIter = pListeners->begin();
+    while ( aIter != pListeners->end() )
+    {
+        (*aIter)->statusChanged( rEvent );
+        ++aIter;
     }
 }
 
-com::sun::star::uno::Reference < XDispatch > ListenerHelper::GetDispatch(
+void ListenerHelper::PostNotify(
+        const Reference < XComponentContext >& xContext,
         const Reference < XFrame >& xFrame,
-        const ::rtl::OUString& aCommand )
+        const ::rtl::OUString& aCommand,
+        const FeatureStateEvent& rEvent )
 {
-    sal_uInt32 nSize = aListeners.size();
-    for ( sal_uInt32 i=0; i<nSize; i++ )
+    if ( !NotificationQueue::get().post( xContext, xFrame, aCommand, rEvent ) )
     {
-        if ( aListeners[i].xFrame == xFrame )
-            return aListeners[i].xDispatch;
+        FeatureStateEvent aEvent( rEvent );
+        Notify( xFrame, aCommand, aEvent );
     }
+}
+
+com::sun::star::uno::Reference < XDispatch > ListenerHelper::GetDispatch(
+        const Reference < XFrame >& xFrame,
+        const ::rtl::OUString& aCommand )
+{
+    XInterface* pFrame = lcl_getIdentity( xFrame );
+    std::lock_guard < std::mutex > aGuard( aListenersMutex );
+    AllListeners::iterator aItem = aListeners.find( pFrame );
+    if ( aItem != aListeners.end() )
+        return aItem->second.xDispatch;
 
     return Reference < XDispatch >();
 }
@@ -116,22 +372,74 @@ void ListenerHelper::AddDispatch(
     ListenerItem aItem;
     aItem.xFrame = xFrame;
     aItem.xDispatch = xDispatch;
-    aListeners.push_back( aItem );
-    xFrame->addEventListener( new ListenerItemEventListener( xFrame ) );
+    aItem.xFrameListener = new ListenerItemEventListener( xFrame );
+
+    XInterface* pFrame = lcl_getIdentity( xFrame );
+    ListenerItem aReplaced;
+    {
+        std::lock_guard < std::mutex > aGuard( aListenersMutex );
+        ListenerItem& rItem = aListeners[pFrame];
+        aReplaced = rItem;
+        rItem = aItem;
+    }
+    if ( aReplaced.xFrameListener.is() )
+        xFrame->removeFrameActionListener( aReplaced.xFrameListener );
+    xFrame->addFrameActionListener( aItem.xFrameListener );
 }
 
-void SAL_CALL ListenerItemEventListener::disposing( const EventObject& aEvent)
+sal_Int32 ListenerHelper::GetFrameCount()
 {
-    AllListeners::iterator aIter = aListeners.begin();
-    while ( aIter != aListeners.end() )
+    std::vector < std::pair < XInterface*, WeakReference < XFrame > > > aFrames;
     {
-        if ( (*aIter).xFrame == mxFrame )
-        {
-            aListeners.erase( aIter );
-            break;
-        }
+        std::lock_guard < std::mutex > aGuard( aListenersMutex );
+        for ( const auto& rItem : aListeners )
+            aFrames.push_back( std::make_pair( rItem.first, rItem.second.xFrame ) );
+    }
+    // Frames that died without being disposed are still in the map
+    return std::count_if( aFrames.begin(), aFrames.end(),
+        []( const std::pair < XInterface*, WeakReference < XFrame > >& rFrame )
+        { return lcl_getIdentity( rFrame.second ) == rFrame.first; } );
+}
 
-        ++aIter;
+ListenerItemEventListener::ListenerItemEventListener( const Reference < XFrame >& xFrame )
+    : mxFrame( xFrame )
+    , mpFrameId( lcl_getIdentity( xFrame ) )
+{
+}
+
+void SAL_CALL ListenerItemEventListener::frameAction( const FrameActionEvent& aEvent )
+{
+    // The dispatch and its listeners belong to the component that goes away,
+    // queryDispatch creates a new dispatch for the next one
+    if ( aEvent.Action != FrameAction_COMPONENT_DETACHING )
+        return;
+
+    ListenerItem aItem;
+    {
+        std::lock_guard < std::mutex > aGuard( aListenersMutex );
+        AllListeners::iterator aIter = aListeners.find( mpFrameId );
+        if ( aIter == aListeners.end() || aIter->second.xFrameListener.get() != this )
+            return;
+        aItem = aIter->second;
+        aListeners.erase( aIter );
+    }
+
+    Reference < XFrame > xFrame( mxFrame );
+    if ( xFrame.is() )
+        xFrame->removeFrameActionListener( this );
+}
+
+void SAL_CALL ListenerItemEventListener::disposing( const EventObject& aEvent)
+{
+    ListenerItem aItem;
+    {
+        std::lock_guard < std::mutex > aGuard( aListenersMutex );
+        AllListeners::iterator aIter = aListeners.find( mpFrameId );
+        if ( aIter == aListeners.end() || aIter->second.xFrameListener.get() != this )
+            return;
+        // Released after the lock: the last references may destroy the dispatch
+        aItem = aIter->second;
+        aListeners.erase( aIter );
     }
 }
 
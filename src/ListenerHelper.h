@@ -20,31 +20,46 @@
 #ifndef INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_LISTENERHELPER_H
 #define INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_LISTENERHELPER_H
 
-#include <map>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include <com/sun/star/frame/XFrame.hpp>
+#include <com/sun/star/frame/XFrameActionListener.hpp>
 #include <com/sun/star/frame/XStatusListener.hpp>
 #include <com/sun/star/frame/XDispatch.hpp>
+#include <com/sun/star/uno/XComponentContext.hpp>
 
 #include <rtl/ustring.hxx>
 #include <cppuhelper/implbase1.hxx>
+#include <cppuhelper/weakref.hxx>
+
+#define NOTIFY_COALESCE_MS 50
 
 typedef std::vector < com::sun::star::uno::Reference < com::sun::star::frame::XStatusListener > > StatusListeners;
 
-typedef std::map < ::rtl::OUString, StatusListeners > ListenerMap;
+// Listener arrays are replaced, never changed in place: Notify calls the listeners of a
+// snapshot without holding the lock, so that they may add or remove listeners meanwhile
+typedef std::shared_ptr < const StatusListeners > StatusListenersSnapshot;
+
+typedef std::unordered_map < ::rtl::OUString, StatusListenersSnapshot, ::rtl::OUStringHash > ListenerMap;
 
 // For every frame there is *one* Dispatch object for all possible commands
 // this struct contains an array of listeners for every supported command
-// these arrays are accessed by a std::map (with the command string as index)
+// these arrays are accessed by a hash map (with the command string as index)
 struct ListenerItem
 {
     ListenerMap aContainer;
     ::com::sun::star::uno::Reference< com::sun::star::frame::XDispatch > xDispatch;
-    ::com::sun::star::uno::Reference< com::sun::star::frame::XFrame > xFrame;
+    // Weak: the registry does not keep frames alive
+    ::com::sun::star::uno::WeakReference< com::sun::star::frame::XFrame > xFrame;
+    // Removes the item when the frame is disposed or its component changes
+    ::com::sun::star::uno::Reference< com::sun::star::frame::XFrameActionListener > xFrameListener;
 };
 
-typedef std::vector < ListenerItem > AllListeners;
+// Frames by identity, i.e. by their XInterface. A key whose frame is gone without being
+// disposed may be taken by a new object, lookups check the weak reference for that.
+typedef std::unordered_map < com::sun::star::uno::XInterface*, ListenerItem > AllListeners;
 
 class ListenerHelper
 {
@@ -61,6 +76,14 @@ public:
         const com::sun::star::uno::Reference < com::sun::star::frame::XFrame >& xFrame,
         const ::rtl::OUString& aCommand,
         com::sun::star::frame::FeatureStateEvent& rEvent );
+    // Like Notify, but delivered later on the main thread. Events posted for the same
+    // frame and command within NOTIFY_COALESCE_MS replace each other, only the last one
+    // reaches the listeners.
+    void PostNotify(
+        const com::sun::star::uno::Reference < com::sun::star::uno::XComponentContext >& xContext,
+        const com::sun::star::uno::Reference < com::sun::star::frame::XFrame >& xFrame,
+        const ::rtl::OUString& aCommand,
+        const com::sun::star::frame::FeatureStateEvent& rEvent );
     com::sun::star::uno::Reference < com::sun::star::frame::XDispatch > GetDispatch(
         const com::sun::star::uno::Reference < com::sun::star::frame::XFrame >& xFrame,
         const ::rtl::OUString& aCommand );
@@ -68,15 +91,18 @@ public:
         const com::sun::star::uno::Reference < com::sun::star::frame::XDispatch > xDispatch,
         const com::sun::star::uno::Reference < com::sun::star::frame::XFrame >& xFrame,
         const ::rtl::OUString& aCommand );
+    // Number of frames with a registered dispatch
+    sal_Int32 GetFrameCount();
 };
 
-class ListenerItemEventListener : public cppu::WeakImplHelper1 < ::com::sun::star::lang::XEventListener >
+class ListenerItemEventListener : public cppu::WeakImplHelper1 < ::com::sun::star::frame::XFrameActionListener >
 {
-    ::com::sun::star::uno::Reference< com::sun::star::frame::XFrame > mxFrame;
+    ::com::sun::star::uno::WeakReference< com::sun::star::frame::XFrame > mxFrame;
+    // Key of the frame in the registry, never dereferenced
+    ::com::sun::star::uno::XInterface* mpFrameId;
 public:
-    ListenerItemEventListener( const com::sun::star::uno::Reference < com::sun::star::frame::XFrame >& xFrame)
-        : mxFrame(xFrame)
-    {}
+    ListenerItemEventListener( const com::sun::star::uno::Reference < com::sun::star::frame::XFrame >& xFrame );
+    virtual void SAL_CALL frameAction( const com::sun::star::frame::FrameActionEvent& aEvent );
     virtual void SAL_CALL disposing( const com::sun::star::lang::EventObject& aEvent );
 };
 
@@ -25,6 +25,56 @@
 #include <com/sun/star/document/XEventBroadcaster.hpp>
 #include <cppuhelper/supportsservice.hxx>
 
+#include "XorPackageEncryption.h"
+
+#include <thread>
+
+namespace
+{
+/// Joins the warm-up thread when the library is unloaded, it must not outlive the code it runs
+struct WarmUpThread
+{
+    std::thread aThread;
+
+    ~WarmUpThread()
+    {
+        if (aThread.joinable())
+            aThread.join();
+    }
+};
+}
+
+/**
+ * Creates the encryption service and lets it get ready for the first save, in the
+ * background and at most once per process.
+ */
+static void lcl_warmUpEncryption(const css::uno::Reference< css::lang::XMultiServiceFactory >& xSMGR)
+{
+    static std::mutex aMutex;
+    static WarmUpThread aWarmUp;
+    std::lock_guard< std::mutex > aGuard(aMutex);
+    if (aWarmUp.aThread.joinable())
+        return;
+
+    aWarmUp.aThread = std::thread([xSMGR]() {
+        try
+        {
+            css::uno::Reference< css::task::XJob > xJob(
+                xSMGR->createInstance(XORENCRYPTEDDATASPACESERVICE_SERVICENAME), css::uno::UNO_QUERY);
+            if (!xJob.is())
+                return;
+
+            css::uno::Sequence< css::beans::NamedValue > lArguments(1);
+            lArguments[0] = css::beans::NamedValue("Command", css::uno::makeAny(::rtl::OUString("WarmUp")));
+            xJob->execute(lArguments);
+        }
+        catch (const css::uno::Exception&)
+        {
+            // The first save just does it itself
+        }
+    });
+}
+
 MyListener::MyListener(const css::uno::Reference< css::lang::XMultiServiceFactory >& xSMGR)
     : m_xSMGR(xSMGR)
 {}
@@ -35,6 +85,7 @@ MyListener::~MyListener()
 css::uno::Any SAL_CALL MyListener::execute(const css::uno::Sequence< css::beans::NamedValue >& lArguments)
 {
     css::uno::Sequence< css::beans::NamedValue > lEnv;
+    css::uno::Sequence< css::beans::NamedValue > lJobConfig;
 
     sal_Int32                     i = 0;
     sal_Int32                     c = lArguments.getLength();
@@ -42,10 +93,19 @@ css::uno::Any SAL_CALL MyListener::execute(const css::uno::Sequence< css::beans:
     for (i=0; i<c; ++i)
     {
         if ( p[i].Name == "Environment" )
-        {
             p[i].Value >>= lEnv;
-            break;
-        }
+        else if ( p[i].Name == "JobConfig" )
+            p[i].Value >>= lJobConfig;
+    }
+
+    // Arguments of the job in Jobs.xcu
+    c = lJobConfig.getLength();
+    p = lJobConfig.getConstArray();
+    for (i=0; i<c; ++i)
+    {
+        bool bWarmUp = false;
+        if ( p[i].Name == "WarmUpEncryption" && (p[i].Value >>= bWarmUp) && bWarmUp )
+            lcl_warmUpEncryption(m_xSMGR);
     }
 
     css::uno::Reference< css::frame::XModel > xModel;
@@ -75,24 +135,9 @@ css::uno::Any SAL_CALL MyListener::execute(const css::uno::Sequence< css::beans:
     if (!xModel.is())
         return css::uno::Any();
 
-    css::uno::Reference< css::lang::XServiceInfo > xInfo(xModel, css::uno::UNO_QUERY);
-    sal_Bool bWriter = ( xInfo->supportsService("com.sun.star.text.TextDocument") &&
-                        !xInfo->supportsService("com.sun.star.text.WebDocument") &&
-                        !xInfo->supportsService("com.sun.star.text.GlobalDocument") );
-
     // We are interested only in Writer. However, here we are
     // notified of all newly opened Documents...
-    if (!bWriter)
-        return css::uno::Any();
-
-    void* pListener = 0;
-    if (bWriter)
-        pListener = (void*)(new WriterListener(m_xSMGR));
-
-    css::uno::Reference< css::document::XEventListener >    xDocListener     (static_cast< css::document::XEventListener* >(pListener), css::uno::UNO_QUERY);
-    css::uno::Reference< css::document::XEventBroadcaster > xDocBroadcaster  (xModel   , css::uno::UNO_QUERY);
-
-    xDocBroadcaster->addEventListener(xDocListener);
+    WriterListener::get(m_xSMGR).attach(xModel);
 
     return css::uno::Any();
 }
@@ -27,8 +27,13 @@
 #include <com/sun/star/lang/XServiceInfo.hpp>
 #include <com/sun/star/task/XJob.hpp>
 #include <com/sun/star/document/XEventListener.hpp>
+#include <com/sun/star/frame/XModel.hpp>
 #include <cppuhelper/implbase1.hxx>
 #include <cppuhelper/implbase2.hxx>
+#include <cppuhelper/weakref.hxx>
+
+#include <mutex>
+#include <unordered_map>
 
 #define MYLISTENER_IMPLEMENTATIONNAME  "vnd.My.impl.NewDocListener"
 #define MYLISTENER_SERVICENAME         "vnd.My.NewDocListener"
@@ -65,17 +70,38 @@ class MyListener : public cppu::WeakImplHelper2< css::task::XJob         ,
     static css::uno::Reference< css::uno::XInterface > st_createInstance(const css::uno::Reference< css::lang::XMultiServiceFactory >& xSMGR);
 };
 
+/**
+ * One instance listens to all Writer documents and tells them apart by the event source.
+ *
+ * It remembers the models it was attached to and whether they are Writer documents,
+ * so a model is classified and registered once, however often the job runs for it.
+ * A model is forgotten when it is disposed.
+ */
 class WriterListener : public cppu::WeakImplHelper1< css::document::XEventListener >
 {
     private:
+        struct Model
+        {
+            css::uno::WeakReference< css::frame::XModel > xModel;
+            bool bWriter;
+        };
+
         css::uno::Reference< css::lang::XMultiServiceFactory > mxMSF;
+        std::mutex maMutex;
+        // By identity of the model
+        std::unordered_map< css::uno::XInterface*, Model > maModels;
 
-    public:
         WriterListener(const css::uno::Reference< css::lang::XMultiServiceFactory >& rxMSF);
 
+    public:
+        static WriterListener& get(const css::uno::Reference< css::lang::XMultiServiceFactory >& rxMSF);
+
         virtual ~WriterListener()
         {}
 
+        /// Listens to the model if it is a Writer document, returns whether it is one
+        bool attach(const css::uno::Reference< css::frame::XModel >& xModel);
+
         // document.XEventListener
     virtual void SAL_CALL notifyEvent(const css::document::EventObject& aEvent);
     virtual void SAL_CALL disposing(const css::lang::EventObject& aEvent);
@@ -18,6 +18,7 @@
  */
 #include "ListenerHelper.h"
 #include "MyProtocolHandler.h"
+#include "SaveMonitor.h"
 
 #include <com/sun/star/awt/MessageBoxButtons.hpp>
 #include <com/sun/star/awt/Toolkit.hpp>
@@ -25,19 +26,28 @@
 #include <com/sun/star/frame/ControlCommand.hpp>
 #include <com/sun/star/frame/DispatchHelper.hpp>
 #include <com/sun/star/frame/XModel2.hpp>
+#include <com/sun/star/frame/XStorable.hpp>
+#include <com/sun/star/lang/IllegalArgumentException.hpp>
+#include <com/sun/star/task/XStatusIndicatorFactory.hpp>
 #include <com/sun/star/text/XTextViewCursorSupplier.hpp>
 #include <com/sun/star/system/SystemShellExecute.hpp>
 #include <com/sun/star/system/SystemShellExecuteFlags.hpp>
 #include <com/sun/star/system/XSystemShellExecute.hpp>
 #include <cppuhelper/supportsservice.hxx>
+#include <rtl/ustrbuf.hxx>
+#include <rtl/uuid.h>
+
+#include <unordered_map>
 
 using namespace com::sun::star::awt;
 using namespace com::sun::star::frame;
 using namespace com::sun::star::system;
+using namespace com::sun::star::task;
 using namespace com::sun::star::uno;
 
 using com::sun::star::beans::NamedValue;
 using com::sun::star::beans::PropertyValue;
+using com::sun::star::lang::IllegalArgumentException;
 using com::sun::star::text::XTextViewCursorSupplier;
 using com::sun::star::util::URL;
 
@@ -79,7 +89,7 @@ void BaseDispatch::SendCommand( const com::sun::star::util::URL& aURL, const ::r
     aCtrlCmd.Arguments = rArgs;
 
     aEvent.State <<= aCtrlCmd;
-    aListenerHelper.Notify( mxFrame, aEvent.FeatureURL.Path, aEvent );
+    aListenerHelper.PostNotify( mxContext, mxFrame, aEvent.FeatureURL.Path, aEvent );
 }
 
 void BaseDispatch::SendCommandTo( const Reference< XStatusListener >& xControl, const URL& aURL, const ::rtl::OUString& rCommand, const Sequence< NamedValue >& rArgs, sal_Bool bEnabled )
@@ -111,29 +121,85 @@ void SAL_CALL MyProtocolHandler::initialize( const Sequence< Any >& aArguments )
     }
 }
 
+namespace
+{
+
+struct CommandEntry
+{
+    const char* pPath;
+    MyCommand eCommand;
+};
+
+const CommandEntry aCommands[] =
+{
+    { "ImageButtonCmd",    MYCOMMAND_IMAGEBUTTON },
+    { "ComboboxCmd",       MYCOMMAND_COMBOBOX },
+    { "StoreEncryptedCmd", MYCOMMAND_STOREENCRYPTED }
+};
+
+}
+
+// Toolbars query and notify the same few URLs all the time: one hash lookup instead of string compares
+static MyCommand lcl_getCommand( const URL& rURL )
+{
+    static const std::unordered_map< ::rtl::OUString, MyCommand, ::rtl::OUStringHash > aCommandMap = []()
+    {
+        std::unordered_map< ::rtl::OUString, MyCommand, ::rtl::OUStringHash > aMap;
+        for ( const auto& rEntry : aCommands )
+            aMap[::rtl::OUString::createFromAscii( rEntry.pPath )] = rEntry.eCommand;
+        return aMap;
+    }();
+
+    if ( rURL.Protocol != MYPROTOCOLHANDLER_PROTOCOL )
+        return MYCOMMAND_NONE;
+    auto aCommand = aCommandMap.find( rURL.Path );
+    return aCommand == aCommandMap.end() ? MYCOMMAND_UNKNOWN : aCommand->second;
+}
+
+bool MyProtocolHandler::isWriterController( const Reference < XController >& xCtrl )
+{
+    if ( !xCtrl.is() )
+        return false;
+
+    // Only when the frame shows another component than last time
+    if ( Reference < XController >( mxCheckedController ) != xCtrl )
+    {
+        mxCheckedController = xCtrl;
+        mbWriterController = Reference < XTextViewCursorSupplier >( xCtrl, UNO_QUERY ).is();
+        mxDispatch.clear();
+    }
+    return mbWriterController;
+}
+
+Reference< XDispatch > MyProtocolHandler::getDispatch( const URL& aURL )
+{
+    if ( mxDispatch.is() )
+        return mxDispatch;
+
+    mxDispatch = aListenerHelper.GetDispatch( mxFrame, aURL.Path );
+    if ( !mxDispatch.is() )
+    {
+        mxDispatch = (BaseDispatch*) new WriterDispatch( mxContext, mxFrame );
+        aListenerHelper.AddDispatch( mxDispatch, mxFrame, aURL.Path );
+    }
+    return mxDispatch;
+}
+
 Reference< XDispatch > SAL_CALL MyProtocolHandler::queryDispatch(   const URL& aURL, const ::rtl::OUString& sTargetFrameName, sal_Int32 nSearchFlags )
 {
     Reference < XDispatch > xRet;
     if ( !mxFrame.is() )
         return 0;
 
-    Reference < XController > xCtrl = mxFrame->getController();
-    if ( xCtrl.is() && aURL.Protocol == "vnd.demo.customencryptionexample.demoaddon:" )
+    // without an appropriate corresponding document the handler doesn't function
+    const MyCommand eCommand = lcl_getCommand( aURL );
+    if ( eCommand == MYCOMMAND_IMAGEBUTTON || eCommand == MYCOMMAND_STOREENCRYPTED )
     {
-        Reference < XTextViewCursorSupplier > xCursor( xCtrl, UNO_QUERY );
-        if ( !xCursor.is() )
-            // without an appropriate corresponding document the handler doesn't function
-            return xRet;
-
-        if ( aURL.Path == "ImageButtonCmd" )
-        {
-            xRet = aListenerHelper.GetDispatch( mxFrame, aURL.Path );
-            if ( !xRet.is() )
-            {
-                xRet = (BaseDispatch*) new WriterDispatch( mxContext, mxFrame );
-                aListenerHelper.AddDispatch( xRet, mxFrame, aURL.Path );
-            }
-        }
+        // Asked before locking, so that the frame is never called with the lock held
+        Reference < XController > xCtrl = mxFrame->getController();
+        std::lock_guard< std::mutex > aGuard( maMutex );
+        if ( isWriterController( xCtrl ) )
+            xRet = getDispatch( aURL );
     }
 
     return xRet;
@@ -143,9 +209,22 @@ Sequence < Reference< XDispatch > > SAL_CALL MyProtocolHandler::queryDispatches(
 {
     sal_Int32 nCount = seqDescripts.getLength();
     Sequence < Reference < XDispatch > > lDispatcher( nCount );
+    if ( !mxFrame.is() )
+        return lDispatcher;
 
+    // The frame is checked once for the whole batch
+    Reference < XController > xCtrl = mxFrame->getController();
+    std::lock_guard< std::mutex > aGuard( maMutex );
+    const bool bWriter = isWriterController( xCtrl );
+    Reference < XDispatch >* pDispatcher = lDispatcher.getArray();
     for( sal_Int32 i=0; i<nCount; ++i )
-        lDispatcher[i] = queryDispatch( seqDescripts[i].FeatureURL, seqDescripts[i].FrameName, seqDescripts[i].SearchFlags );
+    {
+        if ( !bWriter )
+            break;
+        const MyCommand eCommand = lcl_getCommand( seqDescripts[i].FeatureURL );
+        if ( eCommand == MYCOMMAND_IMAGEBUTTON || eCommand == MYCOMMAND_STOREENCRYPTED )
+            pDispatcher[i] = getDispatch( seqDescripts[i].FeatureURL );
+    }
 
     return lDispatcher;
 }
@@ -185,6 +264,75 @@ Sequence< ::rtl::OUString > SAL_CALL MyProtocolHandler::getSupportedServiceNames
     return MyProtocolHandler_getSupportedServiceNames();
 }
 
+// Identifies the document across saves, so that the encryption can reuse the unchanged part of the previous save.
+// It is kept in the EncryptionData of the model, which autosave passes again. Empty if the document has none yet.
+static ::rtl::OUString lcl_findDocumentId( const Reference< XModel >& xModel )
+{
+    Sequence< PropertyValue > aArgs = xModel->getArgs();
+    for ( const auto& rArg : aArgs )
+    {
+        Sequence< NamedValue > aEncryptionData;
+        if ( rArg.Name != "EncryptionData" || !( rArg.Value >>= aEncryptionData ) )
+            continue;
+        for ( const auto& rValue : aEncryptionData )
+        {
+            ::rtl::OUString sDocumentId;
+            if ( rValue.Name == "DocumentId" && ( rValue.Value >>= sDocumentId ) && !sDocumentId.isEmpty() )
+                return sDocumentId;
+        }
+    }
+    return ::rtl::OUString();
+}
+
+// Id of the document, a new one if it has none. Only for saves that keep it in the model's arguments.
+static ::rtl::OUString lcl_getDocumentId( const Reference< XModel >& xModel )
+{
+    ::rtl::OUString sDocumentId = lcl_findDocumentId( xModel );
+    if ( !sDocumentId.isEmpty() )
+        return sDocumentId;
+
+    sal_uInt8 aUuid[16];
+    rtl_createUuid( aUuid, nullptr, false );
+    ::rtl::OUStringBuffer aBuffer;
+    for ( sal_uInt8 nByte : aUuid )
+    {
+        if ( nByte < 16 )
+            aBuffer.append( '0' );
+        aBuffer.append( static_cast< sal_Int32 >( nByte ), 16 );
+    }
+    return aBuffer.makeStringAndClear();
+}
+
+// EncryptionData of a save in our encryption: the options of the encryption service, see
+// XorPackageEncryption::setupEncryption, plus CryptoType to select it and the DocumentId if there is one
+static Sequence< NamedValue > lcl_createEncryptionData( const ::rtl::OUString& sDocumentId,
+                                                        const Sequence< NamedValue >& rOptions )
+{
+    const sal_Int32 nFixed = sDocumentId.isEmpty() ? 1 : 2;
+    Sequence< NamedValue > aEncryptionData( nFixed + rOptions.getLength() );
+    aEncryptionData[0] = NamedValue( "CryptoType", makeAny( ::rtl::OUString( "XorEncryptedDataSpace" ) ) );
+    if ( !sDocumentId.isEmpty() )
+        aEncryptionData[1] = NamedValue( "DocumentId", makeAny( sDocumentId ) );
+    for ( sal_Int32 i = 0; i < rOptions.getLength(); i++ )
+        aEncryptionData[nFixed + i] = rOptions[i];
+    return aEncryptionData;
+}
+
+void StoreEncrypted( const Reference< XModel >& xModel, const ::rtl::OUString& rURL,
+                     const ::rtl::OUString& rFilterName, const Sequence< NamedValue >& rEncryptionOptions )
+{
+    Sequence< PropertyValue > aMediaDescriptor( 2 );
+    aMediaDescriptor[0].Name = "FilterName";
+    aMediaDescriptor[0].Value <<= ( rFilterName.isEmpty() ? ::rtl::OUString( MYPROTOCOLHANDLER_DEFAULT_FILTER ) : rFilterName );
+    aMediaDescriptor[1].Name = "EncryptionData";
+    // storeToURL does not keep the arguments in the model, so a new id would never be seen again
+    aMediaDescriptor[1].Value <<= lcl_createEncryptionData( lcl_findDocumentId( xModel ), rEncryptionOptions );
+
+    // A copy: the model keeps its location and arguments
+    Reference< XStorable > xStorable( xModel, UNO_QUERY_THROW );
+    xStorable->storeToURL( rURL, aMediaDescriptor );
+}
+
 void SAL_CALL BaseDispatch::dispatch( const URL& aURL, const Sequence < PropertyValue >& lArgs )
 {
     /* It's necessary to hold this object alive, till this method finishes.
@@ -196,12 +344,25 @@ void SAL_CALL BaseDispatch::dispatch( const URL& aURL, const Sequence < Property
      */
     Reference< XInterface > xSelfHold(static_cast< XDispatch* >(this), UNO_QUERY);
 
-    if ( aURL.Protocol == "vnd.demo.customencryptionexample.demoaddon:" )
+    switch ( lcl_getCommand( aURL ) )
     {
-        if ( aURL.Path == "ImageButtonCmd" )
+        case MYCOMMAND_IMAGEBUTTON:
         {
-			Sequence<NamedValue> aEncryptionArgs(1);
-			aEncryptionArgs[0] = NamedValue("CryptoType", makeAny(rtl::OUString("XorEncryptedDataSpace")));
+			Reference< XController > xCtrl = mxFrame->getController();
+			Reference< XModel > xModel = xCtrl->getModel();
+
+			const ::rtl::OUString sDocumentId = lcl_getDocumentId(xModel);
+
+			// The encryption reports its progress to the status bar of this frame
+			Reference<XStatusIndicator> xIndicator;
+			Reference<XStatusIndicatorFactory> xIndicatorFactory(mxFrame, UNO_QUERY);
+			if ( xIndicatorFactory.is() )
+				xIndicator = xIndicatorFactory->createStatusIndicator();
+			// Pressed again while the indicator processes events during the save: ignore it
+			if ( !SaveMonitor::get().begin(sDocumentId, xIndicator) )
+				return;
+
+			Sequence<NamedValue> aEncryptionArgs = lcl_createEncryptionData(sDocumentId, Sequence<NamedValue>());
 
 			// create ENCRYPTIONDATA PropertyValue
 			PropertyValue aEncryptionData;
@@ -212,17 +373,24 @@ void SAL_CALL BaseDispatch::dispatch( const URL& aURL, const Sequence < Property
 			Sequence<PropertyValue> aNewArgs(1);
 			aNewArgs[0] = aEncryptionData;
 
-			// set args
-			Reference< XController > xCtrl = mxFrame->getController();
-			Reference< XModel > xModel = xCtrl->getModel();
-			Reference< XModel2 > xModel2(xModel, UNO_QUERY_THROW);
-			xModel2->setArgs(aNewArgs);
-
-			rtl::OUString rCommand = ".uno:SaveAs";
-			Sequence<PropertyValue> rPropertyValues;
-			Reference<XDispatchHelper> xDispatchHelper(DispatchHelper::create(mxContext));
-			Reference<XDispatchProvider> xProvider(mxFrame.get(), UNO_QUERY); 
-			xDispatchHelper->executeDispatch(xProvider, rCommand, rtl::OUString(), 0, rPropertyValues); 
+			try
+			{
+				// set args
+				Reference< XModel2 > xModel2(xModel, UNO_QUERY_THROW);
+				xModel2->setArgs(aNewArgs);
+
+				rtl::OUString rCommand = ".uno:SaveAs";
+				Sequence<PropertyValue> rPropertyValues;
+				Reference<XDispatchHelper> xDispatchHelper(DispatchHelper::create(mxContext));
+				Reference<XDispatchProvider> xProvider(mxFrame.get(), UNO_QUERY);
+				xDispatchHelper->executeDispatch(xProvider, rCommand, rtl::OUString(), 0, rPropertyValues);
+			}
+			catch (...)
+			{
+				SaveMonitor::get().end(sDocumentId);
+				throw;
+			}
+			SaveMonitor::get().end(sDocumentId);
 
             // open the LibreOffice web page
 /*            ::rtl::OUString sURL("http://www.libreoffice.org");
@@ -237,14 +405,40 @@ void SAL_CALL BaseDispatch::dispatch( const URL& aURL, const Sequence < Property
                 (void)rEx;
             }*/
         }
+        break;
+
+        case MYCOMMAND_STOREENCRYPTED:
+        {
+            ::rtl::OUString sURL;
+            ::rtl::OUString sFilterName;
+            Sequence< NamedValue > aEncryptionOptions;
+            for ( const auto& rArg : lArgs )
+            {
+                if ( rArg.Name == "URL" )
+                    rArg.Value >>= sURL;
+                else if ( rArg.Name == "FilterName" )
+                    rArg.Value >>= sFilterName;
+                else if ( rArg.Name == "EncryptionData" )
+                    rArg.Value >>= aEncryptionOptions;
+            }
+            if ( sURL.isEmpty() )
+                throw IllegalArgumentException( "StoreEncryptedCmd needs a URL", static_cast< XDispatch* >( this ), 0 );
+
+            StoreEncrypted( mxFrame->getController()->getModel(), sURL, sFilterName, aEncryptionOptions );
+        }
+        break;
+
+        default:
+            break;
     }
 }
 
 void SAL_CALL BaseDispatch::addStatusListener( const Reference< XStatusListener >& xControl, const URL& aURL )
 {
-    if ( aURL.Protocol == "vnd.demo.customencryptionexample.demoaddon:" )
+    const MyCommand eCommand = lcl_getCommand( aURL );
+    if ( eCommand != MYCOMMAND_NONE )
     {
-        if ( aURL.Path == "ImageButtonCmd" )
+        if ( eCommand == MYCOMMAND_IMAGEBUTTON )
         {
             // just enable this command
             ::com::sun::star::frame::FeatureStateEvent aEvent;
@@ -267,11 +461,8 @@ void SAL_CALL BaseDispatch::removeStatusListener( const Reference< XStatusListen
 
 void SAL_CALL BaseDispatch::controlEvent( const ControlEvent& Event )
 {
-    if ( Event.aURL.Protocol == "vnd.demo.customencryptionexample.demoaddon:" )
+    if ( lcl_getCommand( Event.aURL ) == MYCOMMAND_COMBOBOX )
     {
-        if ( Event.aURL.Path == "ComboboxCmd" )
-        {
-        }
     }
 }
 
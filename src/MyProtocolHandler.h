@@ -26,11 +26,27 @@
 #include <com/sun/star/lang/XServiceInfo.hpp>
 #include <com/sun/star/frame/XDispatchProvider.hpp>
 #include <com/sun/star/frame/XControlNotificationListener.hpp>
+#include <com/sun/star/frame/XController.hpp>
+#include <cppuhelper/weakref.hxx>
 #include <cppuhelper/implbase2.hxx>
 #include <cppuhelper/implbase3.hxx>
 
+#include <mutex>
+
 #define MYPROTOCOLHANDLER_IMPLEMENTATIONNAME   "vnd.demo.Impl.ProtocolHandler"
 #define MYPROTOCOLHANDLER_SERVICENAME          "vnd.demo.ProtocolHandler"
+#define MYPROTOCOLHANDLER_PROTOCOL             "vnd.demo.customencryptionexample.demoaddon:"
+#define MYPROTOCOLHANDLER_DEFAULT_FILTER       "MS Word 2007 XML"
+
+// Commands of the protocol, see lcl_getCommand
+enum MyCommand
+{
+    MYCOMMAND_NONE,     // another protocol
+    MYCOMMAND_UNKNOWN,  // our protocol, unknown path
+    MYCOMMAND_IMAGEBUTTON,
+    MYCOMMAND_COMBOBOX,
+    MYCOMMAND_STOREENCRYPTED
+};
 
 namespace com
 {
@@ -59,10 +75,20 @@ class MyProtocolHandler : public cppu::WeakImplHelper3
 private:
     ::com::sun::star::uno::Reference< ::com::sun::star::uno::XComponentContext > mxContext;
     ::com::sun::star::uno::Reference< ::com::sun::star::frame::XFrame > mxFrame;
+    // Guards the members below, the frame may be queried from more than one thread
+    std::mutex maMutex;
+    // Controller of the frame when it was last checked for being Writer's, and the result
+    ::com::sun::star::uno::WeakReference< ::com::sun::star::frame::XController > mxCheckedController;
+    bool mbWriterController;
+    ::com::sun::star::uno::Reference< ::com::sun::star::frame::XDispatch > mxDispatch;
+
+    // Both are called with maMutex held
+    bool isWriterController( const ::com::sun::star::uno::Reference< ::com::sun::star::frame::XController >& xCtrl );
+    ::com::sun::star::uno::Reference< ::com::sun::star::frame::XDispatch > getDispatch( const ::com::sun::star::util::URL& aURL );
 
 public:
     MyProtocolHandler( const ::com::sun::star::uno::Reference< ::com::sun::star::uno::XComponentContext > &rxContext)
-        : mxContext( rxContext ) {}
+        : mxContext( rxContext ), mbWriterController( false ) {}
 
     // XDispatchProvider
     virtual ::com::sun::star::uno::Reference< ::com::sun::star::frame::XDispatch >
@@ -90,6 +116,14 @@ sal_Bool SAL_CALL MyProtocolHandler_supportsService( const ::rtl::OUString& Serv
 ::com::sun::star::uno::Reference< ::com::sun::star::uno::XInterface >
 SAL_CALL MyProtocolHandler_createInstance( const ::com::sun::star::uno::Reference< ::com::sun::star::uno::XComponentContext > & rContext);
 
+// Stores a copy of the document to rURL, encrypted with XorEncryptedDataSpace, without any UI.
+// An empty filter name selects MYPROTOCOLHANDLER_DEFAULT_FILTER. rEncryptionOptions go to the
+// encryption service next to CryptoType, e.g. Password or PartIndex. The DocumentId of the
+// model goes along only if it already has one: a copy does not keep a new one.
+void StoreEncrypted( const ::com::sun::star::uno::Reference< ::com::sun::star::frame::XModel >& xModel,
+                     const ::rtl::OUString& rURL, const ::rtl::OUString& rFilterName,
+                     const ::com::sun::star::uno::Sequence< ::com::sun::star::beans::NamedValue >& rEncryptionOptions );
+
 class BaseDispatch : public cppu::WeakImplHelper2
 <
     ::com::sun::star::frame::XDispatch,
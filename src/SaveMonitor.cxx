@@ -0,0 +1,91 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+#include "SaveMonitor.h"
+
+using namespace css::task;
+using namespace css::uno;
+
+SaveMonitor& SaveMonitor::get()
+{
+    static SaveMonitor* pMonitor = new SaveMonitor();
+    return *pMonitor;
+}
+
+bool SaveMonitor::begin(const rtl::OUString& rDocumentId, const Reference<XStatusIndicator>& rxIndicator)
+{
+    std::shared_ptr<Save> pSave = std::make_shared<Save>();
+    pSave->xIndicator = rxIndicator;
+    std::lock_guard<std::mutex> aGuard(maMutex);
+    return maSaves.insert(std::make_pair(rDocumentId, pSave)).second;
+}
+
+void SaveMonitor::end(const rtl::OUString& rDocumentId)
+{
+    std::lock_guard<std::mutex> aGuard(maMutex);
+    maSaves.erase(rDocumentId);
+}
+
+std::shared_ptr<SaveMonitor::Save> SaveMonitor::find(const rtl::OUString& rDocumentId)
+{
+    std::lock_guard<std::mutex> aGuard(maMutex);
+    auto aSave = maSaves.find(rDocumentId);
+    return aSave == maSaves.end() ? nullptr : aSave->second;
+}
+
+SaveProgress::SaveProgress(const rtl::OUString& rDocumentId, sal_Int64 nTotal)
+    : mnTotal(nTotal)
+    , mnPercent(0)
+{
+    if (!rDocumentId.isEmpty())
+        mpSave = SaveMonitor::get().find(rDocumentId);
+    if (mpSave && mpSave->xIndicator.is())
+        mpSave->xIndicator->start("Encrypting document", 100);
+}
+
+SaveProgress::~SaveProgress()
+{
+    if (mpSave && mpSave->xIndicator.is())
+    {
+        try
+        {
+            mpSave->xIndicator->end();
+        }
+        catch (const Exception&)
+        {
+        }
+    }
+}
+
+ProgressFunction SaveProgress::getFunction()
+{
+    if (!mpSave)
+        return ProgressFunction();
+
+    return [this](sal_Int64 nWrittenBytes) {
+        // The indicator processes events on every update, only call it when the value changes
+        const sal_Int32 nPercent = mnTotal > 0 ? nWrittenBytes * 100 / mnTotal : 100;
+        if (nPercent != mnPercent && mpSave->xIndicator.is())
+        {
+            mnPercent = nPercent;
+            mpSave->xIndicator->setValue(nPercent);
+        }
+    };
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,82 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+
+#ifndef INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_SAVEMONITOR_H
+#define INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_SAVEMONITOR_H
+
+#include "TransformEngine.h"
+
+#include <rtl/ustring.hxx>
+#include <com/sun/star/task/XStatusIndicator.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+/**
+ * Saves started from the toolbar, by DocumentId.
+ *
+ * The protocol handler registers a save with the status indicator of its frame before
+ * it dispatches .uno:SaveAs, and the encryption service, called from inside that save,
+ * reports the progress of the transform there.
+ *
+ * The save runs on the main thread, as storing a model has to, so it can not be
+ * cancelled. Updating the indicator processes pending UI events, which can dispatch
+ * the toolbar command again while the document is stored: begin refuses a second save
+ * of the same document, so that the handler ignores it instead of nesting it.
+ */
+class SaveMonitor
+{
+public:
+    struct Save
+    {
+        css::uno::Reference< css::task::XStatusIndicator > xIndicator;
+    };
+
+private:
+    std::mutex maMutex;
+    std::map< rtl::OUString, std::shared_ptr< Save > > maSaves;
+
+    SaveMonitor() {}
+public:
+    static SaveMonitor& get();
+
+    /// Returns false if a save of the document is running already
+    bool begin(const rtl::OUString& rDocumentId, const css::uno::Reference< css::task::XStatusIndicator >& rxIndicator);
+    void end(const rtl::OUString& rDocumentId);
+    std::shared_ptr< Save > find(const rtl::OUString& rDocumentId);
+};
+
+/// Progress of one transform within a monitored save. Ends the indicator when destroyed.
+class SaveProgress
+{
+    std::shared_ptr< SaveMonitor::Save > mpSave;
+    sal_Int64 mnTotal;
+    sal_Int32 mnPercent;
+public:
+    SaveProgress(const rtl::OUString& rDocumentId, sal_Int64 nTotal);
+    ~SaveProgress();
+
+    /// Empty if the document is not being saved from the toolbar
+    ProgressFunction getFunction();
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
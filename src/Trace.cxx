@@ -0,0 +1,110 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+namespace
+{
+struct TraceFile
+{
+    std::mutex aMutex;
+    FILE* pFile = nullptr;
+    bool bFirstEvent = true;
+    std::chrono::steady_clock::time_point aStart = std::chrono::steady_clock::now();
+};
+}
+
+static TraceFile* lcl_openTraceFile()
+{
+    TraceFile* pTrace = new TraceFile();
+    const char* pPath = getenv("XORENCRYPTION_TRACE_FILE");
+    if (pPath && *pPath)
+        pTrace->pFile = fopen(pPath, "w");
+    // The closing bracket is optional in the array format, so a trace cut short by a crash still loads
+    if (pTrace->pFile)
+        fputs("[\n", pTrace->pFile);
+    return pTrace;
+}
+
+static TraceFile& lcl_getTraceFile()
+{
+    static TraceFile* pTrace = lcl_openTraceFile();
+    return *pTrace;
+}
+
+static sal_Int64 lcl_getMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - lcl_getTraceFile().aStart).count();
+}
+
+static sal_Int32 lcl_getThreadId()
+{
+    static std::atomic<sal_Int32> nNextThreadId(1);
+    static thread_local sal_Int32 nThreadId = nNextThreadId++;
+    return nThreadId;
+}
+
+// Spans open on the current thread; the file is flushed when the outermost one ends
+static thread_local sal_Int32 nDepth = 0;
+
+bool TraceSpan::isEnabled()
+{
+    static const bool bEnabled = lcl_getTraceFile().pFile != nullptr;
+    return bEnabled;
+}
+
+TraceSpan::TraceSpan(const char* pName, sal_Int64 nBytes)
+    : mpName(pName)
+    , mnBytes(nBytes)
+    , mnStart(-1)
+{
+    if (!isEnabled())
+        return;
+    ++nDepth;
+    mnStart = lcl_getMicroseconds();
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (mnStart < 0)
+        return;
+
+    const sal_Int64 nDuration = lcl_getMicroseconds() - mnStart;
+    const sal_Int32 nThreadId = lcl_getThreadId();
+    TraceFile& rTrace = lcl_getTraceFile();
+    std::lock_guard<std::mutex> aGuard(rTrace.aMutex);
+    fprintf(rTrace.pFile, "%s{\"name\":\"%s\",\"cat\":\"xorencryption\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+            "\"ts\":%lld,\"dur\":%lld",
+            rTrace.bFirstEvent ? "" : ",\n", mpName, static_cast<int>(nThreadId),
+            static_cast<long long>(mnStart), static_cast<long long>(nDuration));
+    if (mnBytes >= 0)
+        fprintf(rTrace.pFile, ",\"args\":{\"bytes\":%lld}", static_cast<long long>(mnBytes));
+    fputs("}", rTrace.pFile);
+    rTrace.bFirstEvent = false;
+    if (--nDepth == 0)
+        fflush(rTrace.pFile);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,60 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+
+#ifndef INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_TRACE_H
+#define INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_TRACE_H
+
+#include <sal/types.h>
+
+/**
+ * Time spent in a scope, recorded as a Chrome trace event.
+ *
+ * Spans are only compiled in with XORENCRYPTION_TRACE defined, and only recorded when
+ * the environment variable XORENCRYPTION_TRACE_FILE names the file to write. That file
+ * opens in chrome://tracing or https://ui.perfetto.dev. Otherwise a span costs a
+ * check of a flag.
+ */
+class TraceSpan
+{
+    const char* mpName;
+    sal_Int64 mnBytes;
+    sal_Int64 mnStart;
+public:
+    explicit TraceSpan(const char* pName, sal_Int64 nBytes = -1);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    static bool isEnabled();
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#if defined(XORENCRYPTION_TRACE)
+/// Traces the rest of the scope: TRACE_SPAN("name") or TRACE_SPAN("name", nBytes)
+#define TRACE_SPAN(...) TraceSpan TRACE_CONCAT(aTraceSpan, __LINE__)(__VA_ARGS__)
+#else
+#define TRACE_SPAN(...) do {} while (false)
+#endif
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
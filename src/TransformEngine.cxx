@@ -0,0 +1,347 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+#include "TransformEngine.h"
+#include "BufferPool.h"
+#include "Trace.h"
+
+#include <com/sun/star/uno/RuntimeException.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace css;
+using namespace css::io;
+using namespace css::uno;
+
+void xorTransform(sal_Int8* pData, sal_Int32 nSize, sal_uInt8 nValue)
+{
+    sal_uInt8* p = reinterpret_cast<sal_uInt8*>(pData);
+    sal_uInt8* pEnd = p + nSize;
+
+    // Sequence payloads follow the sequence header, so they are never cache line aligned.
+    // Go byte-wise up to the first word boundary, then whole words: that loop is what
+    // the compiler turns into vector instructions.
+    while (p != pEnd && (reinterpret_cast<sal_uIntPtr>(p) & (sizeof(sal_uInt64) - 1)))
+        *p++ ^= nValue;
+
+    const sal_uInt64 nPattern = sal_uInt64(0x0101010101010101) * nValue;
+    for (; pEnd - p >= static_cast<std::ptrdiff_t>(sizeof(sal_uInt64)); p += sizeof(sal_uInt64))
+    {
+        sal_uInt64 nWord;
+        memcpy(&nWord, p, sizeof(nWord));
+        nWord ^= nPattern;
+        memcpy(p, &nWord, sizeof(nWord));
+    }
+
+    while (p != pEnd)
+        *p++ ^= nValue;
+}
+
+void positionMaskTransform(sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset)
+{
+    for (sal_Int32 i = 0; i < nSize; i++)
+    {
+        // Top byte of a Fibonacci hash of the position
+        const sal_uInt64 nPosition = nOffset + i;
+        pData[i] ^= static_cast<sal_Int8>((nPosition * sal_uInt64(0x9E3779B97F4A7C15)) >> 56);
+    }
+}
+
+void TransformChain::encrypt(sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset) const
+{
+    if (maStages.size() == 1)
+    {
+        maStages[0].aEncrypt(pData, nSize, nOffset);
+        return;
+    }
+
+    for (sal_Int32 nBlock = 0; nBlock < nSize; nBlock += TRANSFORM_FUSION_BLOCK_SIZE)
+    {
+        const sal_Int32 nBlockSize = std::min<sal_Int32>(nSize - nBlock, TRANSFORM_FUSION_BLOCK_SIZE);
+        for (const auto& rStage : maStages)
+            rStage.aEncrypt(pData + nBlock, nBlockSize, nOffset + nBlock);
+    }
+}
+
+void TransformChain::decrypt(sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset) const
+{
+    if (maStages.size() == 1)
+    {
+        maStages[0].aDecrypt(pData, nSize, nOffset);
+        return;
+    }
+
+    for (sal_Int32 nBlock = 0; nBlock < nSize; nBlock += TRANSFORM_FUSION_BLOCK_SIZE)
+    {
+        const sal_Int32 nBlockSize = std::min<sal_Int32>(nSize - nBlock, TRANSFORM_FUSION_BLOCK_SIZE);
+        for (auto aIter = maStages.rbegin(); aIter != maStages.rend(); ++aIter)
+            aIter->aDecrypt(pData + nBlock, nBlockSize, nOffset + nBlock);
+    }
+}
+
+XorKeystream::XorKeystream(const Sequence<sal_Int8>& rKey)
+    : maKey(rKey.begin(), rKey.end())
+{
+    if (maKey.empty())
+        throw RuntimeException("XorKeystream: empty key");
+}
+
+XorKeystream XorKeystream::combine(const XorKeystream& rFirst, const XorKeystream& rSecond)
+{
+    size_t nLength = rFirst.maKey.size();
+    while (nLength % rSecond.maKey.size())
+        nLength += rFirst.maKey.size();
+
+    XorKeystream aCombined(0);
+    aCombined.maKey.resize(nLength);
+    for (size_t i = 0; i < nLength; i++)
+        aCombined.maKey[i] = rFirst.maKey[i % rFirst.maKey.size()] ^ rSecond.maKey[i % rSecond.maKey.size()];
+    return aCombined;
+}
+
+void XorKeystream::apply(sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset) const
+{
+    if (maKey.size() == 1)
+    {
+        xorTransform(pData, nSize, maKey[0]);
+        return;
+    }
+
+    size_t nKeyPos = nOffset % maKey.size();
+    for (sal_Int32 i = 0; i < nSize; i++)
+    {
+        pData[i] ^= maKey[nKeyPos];
+        if (++nKeyPos == maKey.size())
+            nKeyPos = 0;
+    }
+}
+
+Sequence<sal_Int8> XorKeystream::getKey() const
+{
+    return Sequence<sal_Int8>(reinterpret_cast<const sal_Int8*>(maKey.data()), maKey.size());
+}
+
+TransformWorkerPool::TransformWorkerPool(sal_Int32 nWorkers)
+{
+    for (sal_Int32 i = 0; i < nWorkers; i++)
+        maWorkers.emplace_back(&TransformWorkerPool::work, this);
+}
+
+TransformWorkerPool& TransformWorkerPool::get()
+{
+    // Never destroyed: joining threads from a static destructor while the library
+    // is unloaded can hang, and idle workers cost nothing at process exit.
+    static TransformWorkerPool* pPool
+        = new TransformWorkerPool(std::max(1u, std::thread::hardware_concurrency()));
+    return *pPool;
+}
+
+void TransformWorkerPool::post(std::function<void()> aTask)
+{
+    {
+        std::lock_guard<std::mutex> aGuard(maMutex);
+        maTasks.push_back(std::move(aTask));
+    }
+    maCondition.notify_one();
+}
+
+void TransformWorkerPool::work()
+{
+    for (;;)
+    {
+        std::function<void()> aTask;
+        {
+            std::unique_lock<std::mutex> aGuard(maMutex);
+            maCondition.wait(aGuard, [this] { return !maTasks.empty(); });
+            aTask = std::move(maTasks.front());
+            maTasks.pop_front();
+        }
+        aTask();
+    }
+}
+
+TransformPipeline::TransformPipeline(sal_Int32 nChunkSize, sal_Int32 nSlots)
+    : mnChunkSize(nChunkSize)
+    , mnChunksRead(0)
+    , mnTasksInFlight(0)
+    , mbReadDone(false)
+    , mbAborted(false)
+{
+    if (nSlots <= 0)
+        nSlots = TransformWorkerPool::get().getWorkerCount() * TRANSFORM_SLOTS_PER_WORKER + 2;
+    maSlots.resize(nSlots);
+    for (auto& rSlot : maSlots)
+        rSlot.aData = BufferPool::get().acquire(mnChunkSize);
+}
+
+TransformPipeline::~TransformPipeline()
+{
+    for (auto& rSlot : maSlots)
+        BufferPool::get().release(rSlot.aData);
+}
+
+void TransformPipeline::fail(std::exception_ptr aError)
+{
+    {
+        std::lock_guard<std::mutex> aGuard(maMutex);
+        if (!maError)
+            maError = aError;
+        mbAborted = true;
+    }
+    maCondition.notify_all();
+}
+
+void TransformPipeline::read(const Reference<XInputStream>& rxInputStream, sal_Int64 nBytes,
+                             const TransformFunction& rTransform)
+{
+    try
+    {
+        sal_Int64 nOffset = 0;
+        while (nOffset < nBytes)
+        {
+            Slot* pSlot;
+            {
+                std::unique_lock<std::mutex> aGuard(maMutex);
+                Slot& rSlot = maSlots[mnChunksRead % maSlots.size()];
+                maCondition.wait(aGuard, [&] { return mbAborted || rSlot.eState == SLOT_FREE; });
+                if (mbAborted)
+                    break;
+                pSlot = &rSlot;
+            }
+
+            sal_Int32 nBytesToRead = std::min<sal_Int64>(mnChunkSize, nBytes - nOffset);
+            sal_Int32 nReadBytes;
+            {
+                TRACE_SPAN("read", nBytesToRead);
+                nReadBytes = rxInputStream->readBytes(pSlot->aData, nBytesToRead);
+            }
+            if (nBytesToRead != nReadBytes)
+            {
+                throw RuntimeException("stream read: payload was not read completely");
+            }
+            pSlot->nOffset = nOffset;
+            nOffset += nReadBytes;
+
+            {
+                std::lock_guard<std::mutex> aGuard(maMutex);
+                pSlot->eState = SLOT_FILLED;
+                ++mnChunksRead;
+                ++mnTasksInFlight;
+            }
+
+            TransformWorkerPool::get().post([this, pSlot, &rTransform]() {
+                try
+                {
+                    TRACE_SPAN("transform", pSlot->aData.getLength());
+                    if (!mbAborted)
+                        rTransform(pSlot->aData.getArray(), pSlot->aData.getLength(), pSlot->nOffset);
+                }
+                catch (...)
+                {
+                    fail(std::current_exception());
+                }
+                // Notify under the lock: once mnTasksInFlight drops to zero run() may
+                // return and destroy the pipeline
+                std::lock_guard<std::mutex> aGuard(maMutex);
+                pSlot->eState = SLOT_TRANSFORMED;
+                --mnTasksInFlight;
+                maCondition.notify_all();
+            });
+        }
+    }
+    catch (...)
+    {
+        fail(std::current_exception());
+    }
+
+    {
+        std::lock_guard<std::mutex> aGuard(maMutex);
+        mbReadDone = true;
+    }
+    maCondition.notify_all();
+}
+
+sal_Int64 TransformPipeline::run(const Reference<XInputStream>& rxInputStream,
+                                 const Reference<XOutputStream>& rxOutputStream,
+                                 sal_Int64 nBytes, const TransformFunction& rTransform,
+                                 const ProgressFunction& rProgress)
+{
+    for (auto& rSlot : maSlots)
+        rSlot.eState = SLOT_FREE;
+    mnChunksRead = 0;
+    mnTasksInFlight = 0;
+    mbReadDone = false;
+    mbAborted = false;
+    maError = nullptr;
+
+    std::thread aReader(&TransformPipeline::read, this, std::cref(rxInputStream), nBytes,
+                        std::cref(rTransform));
+
+    sal_Int64 nWrittenBytes = 0;
+    try
+    {
+        for (sal_Int64 nChunk = 0;; nChunk++)
+        {
+            Slot* pSlot;
+            {
+                std::unique_lock<std::mutex> aGuard(maMutex);
+                Slot& rSlot = maSlots[nChunk % maSlots.size()];
+                maCondition.wait(aGuard, [&] {
+                    return mbAborted || rSlot.eState == SLOT_TRANSFORMED
+                           || (mbReadDone && nChunk >= mnChunksRead);
+                });
+                if (mbAborted || rSlot.eState != SLOT_TRANSFORMED)
+                    break;
+                pSlot = &rSlot;
+            }
+
+            {
+                TRACE_SPAN("write", pSlot->aData.getLength());
+                rxOutputStream->writeBytes(pSlot->aData);
+            }
+            nWrittenBytes += pSlot->aData.getLength();
+            if (rProgress)
+                rProgress(nWrittenBytes);
+
+            {
+                std::lock_guard<std::mutex> aGuard(maMutex);
+                pSlot->eState = SLOT_FREE;
+            }
+            maCondition.notify_all();
+        }
+    }
+    catch (...)
+    {
+        fail(std::current_exception());
+    }
+
+    aReader.join();
+    {
+        // Chunks still queued on the pool refer to our slots
+        std::unique_lock<std::mutex> aGuard(maMutex);
+        maCondition.wait(aGuard, [this] { return mnTasksInFlight == 0; });
+    }
+
+    if (maError)
+        std::rethrow_exception(maError);
+
+    return nWrittenBytes;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,169 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+
+#ifndef INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_TRANSFORMENGINE_H
+#define INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_TRANSFORMENGINE_H
+
+#include <com/sun/star/io/XInputStream.hpp>
+#include <com/sun/star/io/XOutputStream.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define TRANSFORM_CHUNK_SIZE (1024 * 1024)
+#define TRANSFORM_SLOTS_PER_WORKER 2
+#define TRANSFORM_FUSION_BLOCK_SIZE (16 * 1024)
+
+// Transforms nSize bytes in place. pData is not necessarily aligned, see BufferPool. nOffset is the position of pData[0] in the whole payload,
+// so position dependent transforms do not care how the payload was split into chunks.
+typedef std::function<void(sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset)> TransformFunction;
+
+// Called on the thread that runs the pipeline after each written chunk, with the bytes written so far
+typedef std::function<void(sal_Int64 nWrittenBytes)> ProgressFunction;
+
+void xorTransform(sal_Int8* pData, sal_Int32 nSize, sal_uInt8 nValue);
+
+// XORs every byte with a mask derived from its position, so that equal plaintext blocks
+// do not turn into equal ciphertext blocks under a short repeating key. Its own inverse.
+void positionMaskTransform(sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset);
+
+/**
+ * Repeating XOR key: byte nOffset of the payload is combined with key byte nOffset % length.
+ *
+ * Applying two keystreams after each other is the same as applying their combination,
+ * which is how encrypted data changes its key without ever being decrypted.
+ */
+class XorKeystream
+{
+    std::vector< sal_uInt8 > maKey;
+public:
+    explicit XorKeystream(sal_uInt8 nValue) : maKey(1, nValue) {}
+    explicit XorKeystream(const css::uno::Sequence< sal_Int8 >& rKey);
+
+    /// Keystream of rFirst followed by rSecond, its length is the lcm of both
+    static XorKeystream combine(const XorKeystream& rFirst, const XorKeystream& rSecond);
+
+    void apply(sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset) const;
+    css::uno::Sequence< sal_Int8 > getKey() const;
+};
+
+/// One transform of a DataSpaces transform chain. Stages keep the size and the offsets of the data.
+struct TransformStage
+{
+    const char* pName; // Storage name in DataSpaceInfo and TransformInfo
+    const char* pId; // TransformInfo ID
+    const char* pTransformName; // TransformInfo name
+    TransformFunction aEncrypt;
+    TransformFunction aDecrypt;
+};
+
+/**
+ * Stages applied one after the other, as listed in DataSpaceInfo: encryption runs them
+ * in order, decryption in reverse order.
+ *
+ * The stages are fused: a chunk is split into blocks small enough for the L1 cache and
+ * each block passes through all stages before the next one is loaded, so that a longer
+ * chain adds work but no further passes over the chunk in memory.
+ */
+class TransformChain
+{
+    std::vector< TransformStage > maStages;
+public:
+    void clear() { maStages.clear(); }
+    void append(const TransformStage& rStage) { maStages.push_back(rStage); }
+    const std::vector< TransformStage >& getStages() const { return maStages; }
+
+    void encrypt(sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset) const;
+    void decrypt(sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset) const;
+};
+
+/**
+ * Process wide pool of threads running the transform of single chunks.
+ *
+ * Tasks posted here must never block: pipelines wait for their chunks on the
+ * reading and writing side only, so a busy pool delays but never deadlocks them.
+ */
+class TransformWorkerPool
+{
+    std::mutex maMutex;
+    std::condition_variable maCondition;
+    std::deque< std::function<void()> > maTasks;
+    std::vector< std::thread > maWorkers;
+
+    TransformWorkerPool(sal_Int32 nWorkers);
+    void work();
+public:
+    static TransformWorkerPool& get();
+
+    void post(std::function<void()> aTask);
+    sal_Int32 getWorkerCount() const { return maWorkers.size(); }
+};
+
+/**
+ * Bounded ring buffer between a reader thread, the transform workers and the writer.
+ *
+ * The reader fills free slots from the input stream, every filled slot is transformed
+ * on the worker pool, and the calling thread writes transformed slots in their original
+ * order. Reading stops while all slots are in flight, so memory stays bounded and slow
+ * reads and writes overlap with each other and with the transform.
+ */
+class TransformPipeline
+{
+    enum SlotState { SLOT_FREE, SLOT_FILLED, SLOT_TRANSFORMED };
+
+    struct Slot
+    {
+        css::uno::Sequence< sal_Int8 > aData;
+        sal_Int64 nOffset;
+        SlotState eState;
+    };
+
+    sal_Int32 mnChunkSize;
+    std::vector< Slot > maSlots;
+    std::mutex maMutex;
+    std::condition_variable maCondition;
+    sal_Int64 mnChunksRead;
+    sal_Int32 mnTasksInFlight;
+    bool mbReadDone;
+    std::atomic<bool> mbAborted;
+    std::exception_ptr maError;
+
+    void read(const css::uno::Reference< css::io::XInputStream >& rxInputStream, sal_Int64 nBytes,
+              const TransformFunction& rTransform);
+    void fail(std::exception_ptr aError);
+public:
+    TransformPipeline(sal_Int32 nChunkSize = TRANSFORM_CHUNK_SIZE, sal_Int32 nSlots = 0);
+    ~TransformPipeline();
+
+    /// Transforms nBytes from rxInputStream into rxOutputStream, returns the number of bytes written.
+    sal_Int64 run(const css::uno::Reference< css::io::XInputStream >& rxInputStream,
+                  const css::uno::Reference< css::io::XOutputStream >& rxOutputStream,
+                  sal_Int64 nBytes, const TransformFunction& rTransform,
+                  const ProgressFunction& rProgress = ProgressFunction());
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,187 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+#include "TransformTuner.h"
+
+#include <com/sun/star/lang/XServiceInfo.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+using namespace css::io;
+using namespace css::lang;
+using namespace css::uno;
+
+static sal_Int32 lcl_getEnvInt(const char* pName, sal_Int32 nDefault)
+{
+    const char* pValue = getenv(pName);
+    return pValue ? atoi(pValue) : nDefault;
+}
+
+// Chunk size bound in kilobytes, clamped to the tuned range before it is turned into bytes
+static sal_Int32 lcl_getEnvChunkSize(const char* pName, sal_Int32 nDefault)
+{
+    const sal_Int32 nKilobytes = lcl_getEnvInt(pName, nDefault / 1024);
+    return std::max(0, std::min(nKilobytes, TUNER_MAX_CHUNK_SIZE / 1024)) * 1024;
+}
+
+static rtl::OUString lcl_getProfileName(const Reference<XInputStream>& rxInputStream, sal_Int64 nBytes)
+{
+    Reference<XServiceInfo> xInfo(rxInputStream, UNO_QUERY);
+    const bool bMemory = xInfo.is() && xInfo->supportsService("com.sun.star.io.SequenceInputStream");
+
+    // Smaller payloads are not tuned, see TUNER_MIN_PAYLOAD_SIZE
+    const char* pSize = nBytes < 128 * 1024 * 1024 ? "<128M" : ">=128M";
+    return rtl::OUString::createFromAscii(bMemory ? "memory/" : "stream/") + rtl::OUString::createFromAscii(pSize);
+}
+
+TransformTuner::TransformTuner()
+    : mnRandom(1)
+{
+    const sal_Int32 nMinChunkSize = std::max(lcl_getEnvChunkSize("XORENCRYPTION_MIN_CHUNK_KB", 0), TUNER_MIN_CHUNK_SIZE);
+    const sal_Int32 nMaxChunkSize = lcl_getEnvChunkSize("XORENCRYPTION_MAX_CHUNK_KB", TUNER_MAX_CHUNK_SIZE);
+    for (sal_Int32 nChunkSize = TUNER_MIN_CHUNK_SIZE; nChunkSize <= TUNER_MAX_CHUNK_SIZE; nChunkSize *= 2)
+    {
+        if (nChunkSize >= nMinChunkSize && nChunkSize <= nMaxChunkSize)
+            maChunkSizes.push_back(nChunkSize);
+    }
+    if (maChunkSizes.empty())
+        maChunkSizes.push_back(TRANSFORM_CHUNK_SIZE);
+
+    const sal_Int32 nWorkers = TransformWorkerPool::get().getWorkerCount();
+    const sal_Int32 nMaxThreads = std::min(lcl_getEnvInt("XORENCRYPTION_MAX_THREADS", nWorkers), nWorkers);
+    for (sal_Int32 nParallelism = 1; nParallelism < nMaxThreads; nParallelism *= 2)
+        maParallelism.push_back(nParallelism);
+    maParallelism.push_back(std::max(nMaxThreads, 1));
+}
+
+TransformTuner& TransformTuner::get()
+{
+    static TransformTuner* pTuner = new TransformTuner();
+    return *pTuner;
+}
+
+TransformTuner::Setting TransformTuner::getSetting(const std::pair<sal_Int32, sal_Int32>& rIndices) const
+{
+    Setting aSetting;
+    aSetting.nChunkSize = maChunkSizes[rIndices.first];
+    aSetting.nParallelism = maParallelism[rIndices.second];
+    return aSetting;
+}
+
+sal_Int64 TransformTuner::run(const Reference<XInputStream>& rxInputStream, const Reference<XOutputStream>& rxOutputStream,
+                              sal_Int64 nBytes, const TransformFunction& rTransform, sal_Int32 nChunkSize,
+                              const ProgressFunction& rProgress)
+{
+    // Too short to tell the settings apart
+    if (nBytes < TUNER_MIN_PAYLOAD_SIZE)
+    {
+        TransformPipeline aPipeline(nChunkSize > 0 ? nChunkSize : TRANSFORM_CHUNK_SIZE);
+        return aPipeline.run(rxInputStream, rxOutputStream, nBytes, rTransform, rProgress);
+    }
+
+    const rtl::OUString sProfile = lcl_getProfileName(rxInputStream, nBytes);
+    std::pair<sal_Int32, sal_Int32> aIndices;
+    {
+        std::lock_guard<std::mutex> aGuard(maMutex);
+        auto aInserted = maProfiles.insert(std::make_pair(sProfile, Measurements()));
+        Measurements& rMeasurements = aInserted.first->second;
+        if (aInserted.second)
+        {
+            // Start from the defaults: the chunk size closest to TRANSFORM_CHUNK_SIZE, all workers
+            auto aChunk = std::lower_bound(maChunkSizes.begin(), maChunkSizes.end(), TRANSFORM_CHUNK_SIZE);
+            rMeasurements.aBest = std::make_pair(
+                std::min<sal_Int32>(aChunk - maChunkSizes.begin(), maChunkSizes.size() - 1),
+                maParallelism.size() - 1);
+            rMeasurements.nRuns = 0;
+        }
+
+        aIndices = rMeasurements.aBest;
+        if (++rMeasurements.nRuns % TUNER_EXPLORE_INTERVAL == 0)
+        {
+            // One step in a random direction
+            mnRandom = mnRandom * 1103515245 + 12345;
+            const sal_Int32 nStep = (mnRandom >> 16) & 1 ? 1 : -1;
+            if ((mnRandom >> 17) & 1)
+                aIndices.first = std::max<sal_Int32>(0, std::min<sal_Int32>(maChunkSizes.size() - 1, aIndices.first + nStep));
+            else
+                aIndices.second = std::max<sal_Int32>(0, std::min<sal_Int32>(maParallelism.size() - 1, aIndices.second + nStep));
+        }
+        if (nChunkSize > 0)
+        {
+            auto aChunk = std::find(maChunkSizes.begin(), maChunkSizes.end(), nChunkSize);
+            if (aChunk == maChunkSizes.end())
+            {
+                TransformPipeline aPipeline(nChunkSize);
+                return aPipeline.run(rxInputStream, rxOutputStream, nBytes, rTransform, rProgress);
+            }
+            aIndices.first = aChunk - maChunkSizes.begin();
+        }
+    }
+
+    const Setting aSetting = getSetting(aIndices);
+    const auto aStart = std::chrono::steady_clock::now();
+    // One slot being read and one being written, the others in the transform
+    TransformPipeline aPipeline(aSetting.nChunkSize, aSetting.nParallelism + 2);
+    const sal_Int64 nWrittenBytes = aPipeline.run(rxInputStream, rxOutputStream, nBytes, rTransform, rProgress);
+    const std::chrono::duration<double> aElapsed = std::chrono::steady_clock::now() - aStart;
+
+    // Time spent in the progress callback is not the transform's
+    if (aElapsed.count() > 0 && !rProgress)
+    {
+        std::lock_guard<std::mutex> aGuard(maMutex);
+        Measurements& rMeasurements = maProfiles.at(sProfile);
+        const double fThroughput = nBytes / aElapsed.count();
+        auto aKnown = rMeasurements.aThroughput.find(aIndices);
+        if (aKnown == rMeasurements.aThroughput.end())
+            rMeasurements.aThroughput.insert(std::make_pair(aIndices, fThroughput));
+        else
+            aKnown->second = 0.7 * aKnown->second + 0.3 * fThroughput;
+
+        // Only measured settings compete, the default one may not have been measured yet
+        auto aBest = rMeasurements.aThroughput.find(rMeasurements.aBest);
+        for (auto aMeasured = rMeasurements.aThroughput.begin(); aMeasured != rMeasurements.aThroughput.end(); ++aMeasured)
+        {
+            if (aBest == rMeasurements.aThroughput.end() || aMeasured->second > aBest->second)
+                aBest = aMeasured;
+        }
+        rMeasurements.aBest = aBest->first;
+    }
+
+    return nWrittenBytes;
+}
+
+std::vector<TransformTuner::Profile> TransformTuner::getProfiles()
+{
+    std::lock_guard<std::mutex> aGuard(maMutex);
+    std::vector<Profile> aProfiles;
+    for (auto& rProfile : maProfiles)
+    {
+        Profile aProfile;
+        aProfile.sName = rProfile.first;
+        aProfile.aCurrent = getSetting(rProfile.second.aBest);
+        auto aMeasured = rProfile.second.aThroughput.find(rProfile.second.aBest);
+        aProfile.fThroughput = aMeasured != rProfile.second.aThroughput.end() ? aMeasured->second : 0;
+        aProfile.nRuns = rProfile.second.nRuns;
+        aProfiles.push_back(aProfile);
+    }
+    return aProfiles;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,97 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This file incorporates work covered by the following license notice:
+ *
+ *   Licensed to the Apache Software Foundation (ASF) under one or more
+ *   contributor license agreements. See the NOTICE file distributed
+ *   with this work for additional information regarding copyright
+ *   ownership. The ASF licenses this file to you under the Apache
+ *   License, Version 2.0 (the "License"); you may not use this file
+ *   except in compliance with the License. You may obtain a copy of
+ *   the License at http://www.apache.org/licenses/LICENSE-2.0 .
+ */
+
+#ifndef INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_TRANSFORMTUNER_H
+#define INCLUDED_EXAMPLES_COMPLEXTOOLBARCONTROLS_TRANSFORMTUNER_H
+
+#include "TransformEngine.h"
+
+#include <rtl/ustring.hxx>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#define TUNER_MIN_CHUNK_SIZE (256 * 1024)
+#define TUNER_MAX_CHUNK_SIZE (8 * 1024 * 1024)
+#define TUNER_EXPLORE_INTERVAL 4
+// Every chunk size gets at least four chunks out of a tuned payload
+#define TUNER_MIN_PAYLOAD_SIZE (4 * sal_Int64(TUNER_MAX_CHUNK_SIZE))
+
+/**
+ * Picks chunk size and parallelism of TransformPipeline runs from measured throughput.
+ *
+ * Runs are grouped into profiles by stream type (in memory or not) and payload size.
+ * Each profile remembers the throughput of the settings it tried, uses the best one,
+ * and every TUNER_EXPLORE_INTERVAL runs tries a neighbouring setting instead, so it
+ * follows changes of load and host. Payloads below TUNER_MIN_PAYLOAD_SIZE run with the
+ * defaults and are not measured.
+ *
+ * Bounds: XORENCRYPTION_MIN_CHUNK_KB, XORENCRYPTION_MAX_CHUNK_KB and
+ * XORENCRYPTION_MAX_THREADS.
+ */
+class TransformTuner
+{
+public:
+    struct Setting
+    {
+        sal_Int32 nChunkSize;
+        sal_Int32 nParallelism;
+    };
+
+    struct Profile
+    {
+        rtl::OUString sName;
+        Setting aCurrent;
+        double fThroughput; // Bytes per second of aCurrent, 0 until it is measured
+        sal_Int32 nRuns;
+    };
+
+private:
+    struct Measurements
+    {
+        std::map< std::pair< sal_Int32, sal_Int32 >, double > aThroughput; // By setting indices
+        std::pair< sal_Int32, sal_Int32 > aBest;
+        sal_Int32 nRuns;
+    };
+
+    std::mutex maMutex;
+    std::map< rtl::OUString, Measurements > maProfiles;
+    std::vector< sal_Int32 > maChunkSizes;
+    std::vector< sal_Int32 > maParallelism;
+    sal_uInt32 mnRandom;
+
+    TransformTuner();
+    Setting getSetting(const std::pair< sal_Int32, sal_Int32 >& rIndices) const;
+public:
+    static TransformTuner& get();
+
+    /// TransformPipeline::run with tuned parameters. nChunkSize > 0 fixes the chunk size.
+    sal_Int64 run(const css::uno::Reference< css::io::XInputStream >& rxInputStream,
+                  const css::uno::Reference< css::io::XOutputStream >& rxOutputStream,
+                  sal_Int64 nBytes, const TransformFunction& rTransform, sal_Int32 nChunkSize = 0,
+                  const ProgressFunction& rProgress = ProgressFunction());
+
+    std::vector< Profile > getProfiles();
+    sal_Int32 getWorkerCount() const { return maParallelism.back(); }
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -21,7 +21,69 @@
 #include "MyListener.h"
 
 
+#include <com/sun/star/document/XEventBroadcaster.hpp>
+#include <com/sun/star/lang/XComponent.hpp>
 #include <com/sun/star/lang/XMultiServiceFactory.hpp>
+#include <com/sun/star/lang/XServiceInfo.hpp>
+
+WriterListener& WriterListener::get( const ::com::sun::star::uno::Reference< ::com::sun::star::lang::XMultiServiceFactory > &rxMSF )
+{
+    // Never released: models still hold it as their listener
+    static WriterListener* pListener = new WriterListener( rxMSF );
+    static ::com::sun::star::uno::Reference< ::com::sun::star::document::XEventListener >* pKeepAlive
+        = new ::com::sun::star::uno::Reference< ::com::sun::star::document::XEventListener >( pListener );
+    (void)pKeepAlive;
+    return *pListener;
+}
+
+bool WriterListener::attach( const ::com::sun::star::uno::Reference< ::com::sun::star::frame::XModel >& xModel )
+{
+    ::com::sun::star::uno::Reference< ::com::sun::star::uno::XInterface > xId( xModel, ::com::sun::star::uno::UNO_QUERY );
+    {
+        std::lock_guard< std::mutex > aGuard( maMutex );
+        auto aModel = maModels.find( xId.get() );
+        if ( aModel != maModels.end() )
+        {
+            ::com::sun::star::uno::Reference< ::com::sun::star::frame::XModel > xKnown( aModel->second.xModel );
+            if ( xKnown.is() && xKnown == xModel )
+                return aModel->second.bWriter;
+            // A model that died without being disposed, and a new one at its address
+            maModels.erase( aModel );
+        }
+    }
+
+    ::com::sun::star::uno::Reference< ::com::sun::star::lang::XServiceInfo > xInfo( xModel, ::com::sun::star::uno::UNO_QUERY );
+    const bool bWriter = xInfo.is()
+                         && xInfo->supportsService( "com.sun.star.text.TextDocument" )
+                         && !xInfo->supportsService( "com.sun.star.text.WebDocument" )
+                         && !xInfo->supportsService( "com.sun.star.text.GlobalDocument" );
+
+    {
+        std::lock_guard< std::mutex > aGuard( maMutex );
+        Model aModel;
+        aModel.xModel = xModel;
+        aModel.bWriter = bWriter;
+        auto aInserted = maModels.insert( std::make_pair( xId.get(), aModel ) );
+        // Attached by another thread meanwhile
+        if ( !aInserted.second )
+            return aInserted.first->second.bWriter;
+    }
+
+    // Writer documents tell about their events, all others only about their disposal
+    if ( bWriter )
+    {
+        ::com::sun::star::uno::Reference< ::com::sun::star::document::XEventBroadcaster > xBroadcaster( xModel, ::com::sun::star::uno::UNO_QUERY );
+        if ( xBroadcaster.is() )
+            xBroadcaster->addEventListener( this );
+    }
+    else
+    {
+        ::com::sun::star::uno::Reference< ::com::sun::star::lang::XComponent > xComponent( xModel, ::com::sun::star::uno::UNO_QUERY );
+        if ( xComponent.is() )
+            xComponent->addEventListener( this );
+    }
+    return bWriter;
+}
 
 void SAL_CALL WriterListener::notifyEvent( const ::com::sun::star::document::EventObject& aEvent )
 {
@@ -29,6 +91,9 @@ void SAL_CALL WriterListener::notifyEvent( const ::com::sun::star::document::Eve
 
 void SAL_CALL WriterListener::disposing( const com::sun::star::lang::EventObject& aSource )
 {
+    ::com::sun::star::uno::Reference< ::com::sun::star::uno::XInterface > xId( aSource.Source, ::com::sun::star::uno::UNO_QUERY );
+    std::lock_guard< std::mutex > aGuard( maMutex );
+    maModels.erase( xId.get() );
 }
 
 WriterListener::WriterListener( const ::com::sun::star::uno::Reference< ::com::sun::star::lang::XMultiServiceFactory > &rxMSF)
@@ -23,15 +23,37 @@
 #include <cppuhelper/supportsservice.hxx>
 #include <com/sun/star/lang/XServiceInfo.hpp>
 #include <com/sun/star/container/XNameContainer.hpp>
+#include <com/sun/star/io/XSeekable.hpp>
+#include <com/sun/star/uno/RuntimeException.hpp>
+#include <com/sun/star/lang/IllegalArgumentException.hpp>
 #include <com/sun/star/io/SequenceInputStream.hpp>
 #include <com/sun/star/packages/XPackageEncryption.hpp>
 #include <com/sun/star/packages/NoEncryptionException.hpp>
 #include <com/sun/star/uno/XComponentContext.hpp>
+#include <com/sun/star/ucb/SimpleFileAccess.hpp>
+#include <com/sun/star/embed/XTransactedObject.hpp>
+#include <rtl/digest.h>
+#include <rtl/alloc.h>
+#include <rtl/random.h>
 
 #include "BinaryStreamHelpers.h"
+#include "DataSpacesRecords.h"
+#include "DecryptedPackageCache.h"
+#include "KeyDerivation.h"
+#include "SaveMonitor.h"
+#include "Trace.h"
+#include "TransformEngine.h"
+#include "TransformTuner.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
 #include <map>
+#include <vector>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 using namespace css;
 using namespace css::beans;
@@ -44,6 +66,83 @@ using namespace std;
 #define XOR_VALUE 127
 #define DATASPACE_NAME "XorEncryptedDataSpace"
 #define TRANSFORM_NAME "XorEncryptedTransform"
+#define TRANSFORM_ID "{C73DFACD-061F-43B0-8B64-AC620D2A8B50}"
+#define POSITION_TRANSFORM_NAME "PositionMaskTransform"
+#define POSITION_TRANSFORM_ID "{5B1F0D6E-2C47-4E8A-9D31-7A0C6E4B2F18}"
+#define MAX_TRANSFORMS 8
+#define DOCUMENT_SUMMARY_STREAM "DocumentSummary"
+#define PART_INDEX_STREAM "PartIndex"
+#define KEY_INFO_STREAM "KeyInfo"
+#define KEY_INFO_VERSION 2
+#define KEY_SALT_LENGTH 16
+#define SEALED_STREAM_HEADER_LENGTH 12
+#define SEALED_STREAM_VERSION 2
+#define ENCRYPT_BATCH_DOCUMENTS 4
+
+namespace
+{
+using namespace dataspaces;
+
+// MS-OFFCRYPTO 2.1.6: DataSpaceMapEntry without its leading Length
+constexpr auto aDataSpaceMapEntry = makeRecord(
+    int32(1), // References count
+    int32(0), // References component type
+    unicode("EncryptedPackage"),
+    unicode(DATASPACE_NAME));
+
+// MS-OFFCRYPTO 2.1.6: DataSpaceMap
+constexpr auto aDataSpaceMap = makeRecord(
+    int32(8), // Header length
+    int32(1), // Entries count
+    int32(4 + aDataSpaceMapEntry.size()), // Length
+    aDataSpaceMapEntry);
+static_assert(4 + aDataSpaceMapEntry.size() == 0x60, "DataSpaceMapEntry layout changed");
+
+// MS-OFFCRYPTO 2.1.7: DataSpaceDefinition, followed by the names of its transforms
+constexpr auto aDataSpaceInfoHeader = makeRecord(
+    int32(0x08), // Header length
+    int32(0)); // Entries count
+
+// MS-OFFCRYPTO 2.1.8: TransformInfoHeader
+constexpr auto makeTransformInfo(const char* pId, const char* pTransformName)
+{
+    return makeRecord(
+        int32(asciiLength(pId) * 2 + ((4 - (asciiLength(pId) & 3)) & 3) + 10), // TransformLength
+        int32(1), // TransformType
+        unicode(pId),
+        unicode(pTransformName),
+        int32(1), // ReaderVersion
+        int32(1), // UpdateVersion
+        int32(1), // WriterVersion
+        int32(4)); // Extensibility Header
+}
+typedef decltype(makeTransformInfo("", "")) TransformInfoRecord;
+
+// MS-OFFCRYPTO 2.1.5: Version
+constexpr auto aVersion = makeRecord(
+    unicode("Microsoft.Container.DataSpaces"), // FeatureIdentifier
+    int32(1), // Reader version
+    int32(1), // Updater version
+    int32(1)); // Writer version
+
+constexpr auto aDataSpaceMapBytes = toBytes<aDataSpaceMap.size()>(aDataSpaceMap);
+
+// Transforms a chain can be made of. All of them are XOR masks, so that Rekey can
+// change the key of a whole chain by combining keystreams, given that the chain has
+// exactly one key stage (see lcl_hasOneKeyStage).
+struct StageDescription
+{
+    const char* pName;
+    const char* pId;
+    const char* pTransformName;
+};
+
+const StageDescription aStageDescriptions[] = {
+    { TRANSFORM_NAME, TRANSFORM_ID, "Microsoft.Metadata.XorTransform" },
+    { POSITION_TRANSFORM_NAME, POSITION_TRANSFORM_ID, "Demo.Metadata.PositionMaskTransform" },
+};
+constexpr auto aVersionBytes = toBytes<aVersion.size()>(aVersion);
+}
 
 void lcl_getListOfStreams(Reference<XNameContainer>& xOLEStorage, map<OUString, Sequence<sal_Int8>>& aStreams, const OUString& sPrefix)
 {
@@ -97,9 +196,258 @@ Reference<XInputStream> XorPackageEncryption::getStream(const Sequence<NamedValu
     return nullptr;
 }
 
+Sequence<sal_Int8> XorPackageEncryption::getStreamData(const Sequence<NamedValue>& rStreams, const OUString& sStreamName)
+{
+    Sequence<sal_Int8> aSeq;
+    for (const auto& aStream : rStreams)
+    {
+        if (aStream.Name == sStreamName)
+        {
+            aStream.Value >>= aSeq;
+            break;
+        }
+    }
+    return aSeq;
+}
+
+static Sequence<sal_Int8> lcl_sha1(const Sequence<sal_Int8>& rFirst, const Sequence<sal_Int8>& rSecond)
+{
+    Sequence<sal_Int8> aInput(rFirst.getLength() + rSecond.getLength());
+    memcpy(aInput.getArray(), rFirst.getConstArray(), rFirst.getLength());
+    memcpy(aInput.getArray() + rFirst.getLength(), rSecond.getConstArray(), rSecond.getLength());
+
+    Sequence<sal_Int8> aDigest(RTL_DIGEST_LENGTH_SHA1);
+    rtl_digest_SHA1(aInput.getConstArray(), aInput.getLength(),
+                    reinterpret_cast<sal_uInt8*>(aDigest.getArray()), aDigest.getLength());
+    return aDigest;
+}
+
+static Sequence<sal_Int8> lcl_utf8(const OUString& rString)
+{
+    OString aString = OUStringToOString(rString, RTL_TEXTENCODING_UTF8);
+    return Sequence<sal_Int8>(reinterpret_cast<const sal_Int8*>(aString.getStr()), aString.getLength());
+}
+
+// KeyInfo version 1 had no iterations: its key is a single salted SHA-1 of the password
+static Sequence<sal_Int8> lcl_deriveKey(const OUString& rPassword, const Sequence<sal_Int8>& rSalt, sal_Int32 nIterations)
+{
+    if (nIterations == 0)
+        return lcl_sha1(rSalt, lcl_utf8(rPassword));
+    return DerivedKeyCache::get().derive(rPassword, rSalt, nIterations);
+}
+
+// What KeyInfo stores to recognize the right password, without storing the key itself
+static Sequence<sal_Int8> lcl_keyVerifier(const Sequence<sal_Int8>& rKey, const Sequence<sal_Int8>& rSalt)
+{
+    return lcl_sha1(rSalt, rKey);
+}
+
+static Sequence<sal_Int8> lcl_randomSalt()
+{
+    Sequence<sal_Int8> aSalt(KEY_SALT_LENGTH);
+    rtlRandomPool aPool = rtl_random_createPool();
+    rtl_random_getBytes(aPool, aSalt.getArray(), aSalt.getLength());
+    rtl_random_destroyPool(aPool);
+    return aSalt;
+}
+
+static bool lcl_readKeyInfo(const Sequence<sal_Int8>& rData, Sequence<sal_Int8>& rSalt, Sequence<sal_Int8>& rVerifier,
+                            sal_Int32& rIterations)
+{
+    RecordReader aReader(rData);
+    sal_Int32 nVersion = 0;
+    sal_Int32 nSaltLength = 0;
+    sal_Int32 nVerifierLength = 0;
+    rIterations = 0;
+    if (!aReader.readInt32(nVersion) || nVersion < 1 || nVersion > KEY_INFO_VERSION)
+        return false;
+    if (nVersion >= 2 && (!aReader.readInt32(rIterations) || rIterations <= 0))
+        return false;
+    if (!aReader.readInt32(nSaltLength))
+        return false;
+    const sal_Int8* pSalt = aReader.take(nSaltLength);
+    aReader.readInt32(nVerifierLength);
+    const sal_Int8* pVerifier = aReader.take(nVerifierLength);
+    if (!aReader.isValid() || nVerifierLength != RTL_DIGEST_LENGTH_SHA1)
+        return false;
+
+    rSalt = Sequence<sal_Int8>(pSalt, nSaltLength);
+    rVerifier = Sequence<sal_Int8>(pVerifier, nVerifierLength);
+    return true;
+}
+
+// Key of a password protected package, or the default key when the package has no KeyInfo
+static bool lcl_unlockKeystream(const Sequence<sal_Int8>& rKeyInfo, const OUString& rPassword, XorKeystream& rKeystream)
+{
+    if (!rKeyInfo.hasElements())
+    {
+        rKeystream = XorKeystream(XOR_VALUE);
+        return true;
+    }
+
+    Sequence<sal_Int8> aSalt;
+    Sequence<sal_Int8> aVerifier;
+    sal_Int32 nIterations;
+    if (!lcl_readKeyInfo(rKeyInfo, aSalt, aVerifier, nIterations))
+        return false;
+    Sequence<sal_Int8> aKey = lcl_deriveKey(rPassword, aSalt, nIterations);
+    if (lcl_keyVerifier(aKey, aSalt) != aVerifier)
+        return false;
+    rKeystream = XorKeystream(aKey);
+    return true;
+}
+
+static sal_uInt32 lcl_getUInt32(const sal_Int8* pData)
+{
+    const sal_uInt8* p = reinterpret_cast<const sal_uInt8*>(pData);
+    return p[0] | p[1] << 8 | p[2] << 16 | sal_uInt32(p[3]) << 24;
+}
+
+// Stage of the given name, its transform uses rKeystream as it is when the chain runs
+static bool lcl_createStage(const OUString& rName, const XorKeystream& rKeystream, TransformStage& rStage)
+{
+    for (const auto& rDescription : aStageDescriptions)
+    {
+        if (!rName.equalsAscii(rDescription.pName))
+            continue;
+
+        rStage.pName = rDescription.pName;
+        rStage.pId = rDescription.pId;
+        rStage.pTransformName = rDescription.pTransformName;
+        if (rName == TRANSFORM_NAME)
+        {
+            const XorKeystream* pKeystream = &rKeystream;
+            rStage.aEncrypt = [pKeystream](sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset) {
+                pKeystream->apply(pData, nSize, nOffset);
+            };
+        }
+        else
+        {
+            rStage.aEncrypt = positionMaskTransform;
+        }
+        rStage.aDecrypt = rStage.aEncrypt;
+        return true;
+    }
+    return false;
+}
+
+// Rekey combines the old and the new keystream once, so a chain must apply the key
+// exactly once: without a key stage the password would not be used, and two of them
+// would cancel each other out.
+static bool lcl_hasOneKeyStage(const TransformChain& rChain)
+{
+    const auto& rStages = rChain.getStages();
+    return std::count_if(rStages.begin(), rStages.end(),
+                         [](const TransformStage& rStage) { return strcmp(rStage.pName, TRANSFORM_NAME) == 0; }) == 1;
+}
+
+typedef std::function<Sequence<sal_Int8>(const OUString& rStreamName)> StreamReader;
+
+// Checks the DataSpaces streams and builds the transform chain they declare
+static bool lcl_readTransformChain(const StreamReader& rReadStream, const XorKeystream& rKeystream, TransformChain& rChain)
+{
+    RecordReader aMapReader(rReadStream("\006DataSpaces/DataSpaceMap"));
+    decltype(aDataSpaceMap)::View aMap;
+    if (!decltype(aDataSpaceMap)::parse(aMapReader, aMap))
+        return false;
+    const auto& rEntry = std::get<3>(aMap);
+    if (!std::get<2>(rEntry).equalsAscii("EncryptedPackage")
+        || !std::get<3>(rEntry).equalsAscii(DATASPACE_NAME))
+        return false;
+
+    RecordReader aInfoReader(rReadStream("\006DataSpaces/DataSpaceInfo/" DATASPACE_NAME));
+    decltype(aDataSpaceInfoHeader)::View aInfo;
+    if (!decltype(aDataSpaceInfoHeader)::parse(aInfoReader, aInfo)
+        || std::get<0>(aInfo) != 8 || std::get<1>(aInfo) < 1 || std::get<1>(aInfo) > MAX_TRANSFORMS)
+        return false;
+
+    TransformChain aChain;
+    for (sal_Int32 i = 0; i < std::get<1>(aInfo); i++)
+    {
+        UnicodeView aName;
+        UnicodeField::parse(aInfoReader, aName);
+        TransformStage aStage;
+        if (!aInfoReader.isValid() || !lcl_createStage(aName.toString(), rKeystream, aStage))
+            return false;
+
+        RecordReader aTransformReader(rReadStream("\006DataSpaces/TransformInfo/" + aName.toString() + "/\006Primary"));
+        TransformInfoRecord::View aTransform;
+        if (!TransformInfoRecord::parse(aTransformReader, aTransform)
+            || !std::get<2>(aTransform).equalsAscii(aStage.pId))
+            return false;
+
+        aChain.append(aStage);
+    }
+    if (!lcl_hasOneKeyStage(aChain))
+        return false;
+    rChain = aChain;
+    return true;
+}
+
+// Key and transform chain of a package, from its KeyInfo and DataSpaces streams. The key
+// stage of rChain refers to rKeystream.
+static bool lcl_unlockTransformChain(const StreamReader& rReadStream, const OUString& rPassword,
+                                     XorKeystream& rKeystream, TransformChain& rChain)
+{
+    return lcl_unlockKeystream(rReadStream("\006DataSpaces/" KEY_INFO_STREAM), rPassword, rKeystream)
+        && lcl_readTransformChain(rReadStream, rKeystream, rChain);
+}
+
+// Decrypts only what is needed to recognize a ZIP package: the signature of the
+// first local file header and the end of central directory record.
+static bool lcl_probeEncryptedPackage(const Sequence<sal_Int8>& rEncryptedPackage, const TransformChain& rChain)
+{
+    const sal_Int32 nEndRecordSize = 22;
+    const sal_Int32 nMaxCommentSize = 0xFFFF;
+
+    if (rEncryptedPackage.getLength() < sal_Int32(sizeof(sal_Int64)) + nEndRecordSize)
+        return false;
+
+    sal_Int64 nSize;
+    memcpy(&nSize, rEncryptedPackage.getConstArray(), sizeof(nSize));
+    const sal_Int8* pPayload = rEncryptedPackage.getConstArray() + sizeof(sal_Int64);
+    if (nSize < nEndRecordSize || nSize > rEncryptedPackage.getLength() - sal_Int64(sizeof(sal_Int64)))
+        return false;
+
+    sal_Int8 aHead[4];
+    memcpy(aHead, pPayload, sizeof(aHead));
+    rChain.decrypt(aHead, sizeof(aHead), 0);
+    if (lcl_getUInt32(aHead) != 0x04034b50) // PK\x03\x04
+        return false;
+
+    const sal_Int64 nLastCandidate = nSize - nEndRecordSize;
+    const sal_Int64 nFirstCandidate = std::max<sal_Int64>(0, nLastCandidate - nMaxCommentSize);
+    Sequence<sal_Int8> aTail(pPayload + nFirstCandidate, nSize - nFirstCandidate);
+    rChain.decrypt(aTail.getArray(), aTail.getLength(), nFirstCandidate);
+    const sal_Int8* pTail = aTail.getConstArray() - nFirstCandidate; // Indexed by payload offset
+    for (sal_Int64 nPos = nLastCandidate; nPos >= nFirstCandidate; nPos--)
+    {
+        if (lcl_getUInt32(pTail + nPos) != 0x06054b50) // PK\x05\x06
+            continue;
+
+        sal_uInt32 nDirectorySize = lcl_getUInt32(pTail + nPos + 12);
+        sal_uInt32 nDirectoryOffset = lcl_getUInt32(pTail + nPos + 16);
+        // Zip64 keeps the real values in its own record
+        if (nDirectoryOffset == 0xFFFFFFFF || nDirectorySize == 0xFFFFFFFF)
+            return true;
+        if (sal_Int64(nDirectoryOffset) + nDirectorySize <= nPos)
+            return true;
+    }
+
+    return false;
+}
+
 XorPackageEncryption::XorPackageEncryption(const Reference<XComponentContext>& rxContext)
     : mxContext(rxContext)
+    , mbProbed(false)
+    , mbProbeSucceeded(false)
+    , mbWriteDocumentSummary(false)
+    , mbWritePartIndex(false)
+    , maKeystream(XOR_VALUE)
 {
+    TransformStage aStage;
+    lcl_createStage(TRANSFORM_NAME, maKeystream, aStage);
+    maChain.append(aStage);
 }
 
 void SAL_CALL XorPackageEncryption::initialize(const Sequence<Any>& rArguments)
@@ -108,22 +456,21 @@ void SAL_CALL XorPackageEncryption::initialize(const Sequence<Any>& rArguments)
 
 Sequence<OUString> XorPackageEncryption::getSupportedServiceNames() throw (RuntimeException)
 {
-    Sequence<OUString> lNames(1);
-    lNames[0] = OUString(XORENCRYPTEDDATASPACESERVICE_SERVICENAME);
+    // Shared by every instance, returning it only copies a reference
+    static const Sequence<OUString> lNames { XORENCRYPTEDDATASPACESERVICE_SERVICENAME };
     return lNames;
 }
 
 sal_Bool SAL_CALL XorPackageEncryption::supportsService(const OUString& sServiceName) throw (RuntimeException)
 {
-    if (sServiceName == XORENCRYPTEDDATASPACESERVICE_SERVICENAME)
-        return true;
-    else
-        return false;
+    // Compares with the literal, without building a string or the name sequence
+    return sServiceName == XORENCRYPTEDDATASPACESERVICE_SERVICENAME;
 }
 
 OUString SAL_CALL XorPackageEncryption::getImplementationName() throw (RuntimeException)
 {
-    return OUString(XORENCRYPTEDDATASPACESERVICE_IMPLEMENTATIONNAME);
+    static const OUString sName(XORENCRYPTEDDATASPACESERVICE_IMPLEMENTATIONNAME);
+    return sName;
 }
 
 
@@ -132,18 +479,93 @@ sal_Bool SAL_CALL XorPackageEncryption::checkDataIntegrity()
     return true;
 }
 
+// Stream size in front of the package, for streams that can not tell their length
+static sal_Int64 lcl_readStreamSize(const Reference<XInputStream>& rxInputStream)
+{
+    Sequence<sal_Int8> aBytes;
+    if (rxInputStream->readBytes(aBytes, sizeof(sal_Int64)) != sizeof(sal_Int64))
+        throw RuntimeException("stream read: value was not read completely");
+    sal_Int64 nSize;
+    memcpy(&nSize, aBytes.getConstArray(), sizeof(sal_Int64));
+    return nSize;
+}
+
+// Writes the package through a Sequence of its own, which is wiped afterwards
+static void lcl_writePackage(const Reference<XOutputStream>& rxOutputStream, const std::vector<sal_Int8>& rPackage)
+{
+    const sal_Int64 nSize = rPackage.size();
+    Sequence<sal_Int8> aChunk;
+    for (sal_Int64 nOffset = 0; nOffset < nSize; nOffset += TRANSFORM_CHUNK_SIZE)
+    {
+        aChunk.realloc(std::min<sal_Int64>(TRANSFORM_CHUNK_SIZE, nSize - nOffset));
+        memcpy(aChunk.getArray(), rPackage.data() + nOffset, aChunk.getLength());
+        rxOutputStream->writeBytes(aChunk);
+    }
+    rtl_secureZeroMemory(aChunk.getArray(), aChunk.getLength());
+}
+
 sal_Bool XorPackageEncryption::decrypt(const Reference<XInputStream>& rxInputStream, Reference<XOutputStream>& rxOutputStream)
 {
-    BinaryXInputStream aInputStream(rxInputStream);
-    BinaryXOutputStream aOutputStream(rxOutputStream);
+    TRACE_SPAN("decrypt");
+    if (mbProbed && !mbProbeSucceeded)
+        return false;
 
-    aInputStream.readInt64(); // Skip stream size
+    Reference<XSeekable> xSeekable(rxInputStream, UNO_QUERY);
+    sal_Int64 nPayloadSize;
+    if (xSeekable.is())
+    {
+        BinaryXInputStream aInputStream(rxInputStream);
+        aInputStream.readInt64(); // Skip stream size
+        nPayloadSize = aInputStream.size() - sizeof(sal_Int64);
+    }
+    else
+    {
+        nPayloadSize = lcl_readStreamSize(rxInputStream);
+    }
 
-    for (int i = 0; i < aInputStream.size() - sizeof(sal_Int64); i++)
+    // Streams that can not seek are decrypted as they come, without the cache
+    DecryptedPackageCache& rCache = DecryptedPackageCache::get();
+    if (!xSeekable.is() || !rCache.isEnabled() || nPayloadSize > rCache.getMaxBytes() || nPayloadSize > SAL_MAX_INT32)
     {
-        sal_Char byte = aInputStream.readValue<sal_Char>();
-        byte ^= XOR_VALUE;
-        aOutputStream.writeValue<sal_Char>(byte);
+        TransformTuner::get().run(rxInputStream, rxOutputStream, nPayloadSize,
+            [this](sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset) { maChain.decrypt(pData, nSize, nOffset); });
+    }
+    else
+    {
+        // Read the package once, hashing it on the way in. On a miss the same buffer is
+        // decrypted in place and handed to the cache, which wipes it on eviction.
+        std::vector<sal_Int8>* pData = new std::vector<sal_Int8>(nPayloadSize);
+        DecryptedPackageCache::Package pBuffer = DecryptedPackageCache::wrap(pData);
+
+        const Sequence<sal_Int8> aKey = getTransformFingerprint();
+        rtlDigest aDigest = rtl_digest_create(rtl_Digest_AlgorithmSHA1);
+        rtl_digest_update(aDigest, aKey.getConstArray(), aKey.getLength());
+        Sequence<sal_Int8> aChunk;
+        sal_Int64 nRead = 0;
+        sal_Int32 nReadBytes;
+        while (nRead < nPayloadSize
+               && (nReadBytes = rxInputStream->readBytes(aChunk, std::min<sal_Int64>(TRANSFORM_CHUNK_SIZE, nPayloadSize - nRead))) > 0)
+        {
+            rtl_digest_update(aDigest, aChunk.getConstArray(), nReadBytes);
+            memcpy(pData->data() + nRead, aChunk.getConstArray(), nReadBytes);
+            nRead += nReadBytes;
+        }
+        sal_uInt8 aHash[RTL_DIGEST_LENGTH_SHA1];
+        rtl_digest_get(aDigest, aHash, RTL_DIGEST_LENGTH_SHA1);
+        rtl_digest_destroy(aDigest);
+        // Same as the pipeline, which the uncached path runs
+        if (nRead != nPayloadSize)
+            throw RuntimeException("stream read: payload was not read completely");
+
+        DecryptedPackageCache::Package pPackage = rCache.lookup(aHash);
+        if (!pPackage)
+        {
+            for (sal_Int64 nOffset = 0; nOffset < nRead; nOffset += TRANSFORM_CHUNK_SIZE)
+                maChain.decrypt(pData->data() + nOffset, std::min<sal_Int64>(TRANSFORM_CHUNK_SIZE, nRead - nOffset), nOffset);
+            pPackage = pBuffer;
+            rCache.insert(aHash, pPackage);
+        }
+        lcl_writePackage(rxOutputStream, *pPackage);
     }
 
     rxOutputStream->flush();
@@ -151,56 +573,148 @@ sal_Bool XorPackageEncryption::decrypt(const Reference<XInputStream>& rxInputStr
     return true;
 }
 
-Sequence<NamedValue> XorPackageEncryption::createEncryptionData(const OUString& /*rPassword*/)
+Sequence<NamedValue> XorPackageEncryption::createEncryptionData(const OUString& rPassword)
 {
-	// Here we need to ensure that we can really to decrypt this doc and than set the CryptoType
-	// Otherwise return emty sequence
-    Sequence<NamedValue> aResult(1);
+    // Only claim documents that passed the probe in readEncryptionInfo
+    if (mbProbed && !mbProbeSucceeded)
+        return Sequence<NamedValue>();
+
+    if (!maKeyInfo.hasElements())
+    {
+        Sequence<NamedValue> aResult(1);
+        aResult[0] = NamedValue("CryptoType", makeAny(OUString("XorEncryptedDataSpace")));
+        return aResult;
+    }
+
+    // Saving again keeps the password. The document gets a fresh salt, which all saves
+    // from now on share, and its key is derived right away while the document loads.
+    Sequence<sal_Int8> aSalt = lcl_randomSalt();
+    DerivedKeyCache::get().prefetch(rPassword, aSalt, KEY_DERIVATION_ITERATIONS);
+    Sequence<NamedValue> aResult(3);
     aResult[0] = NamedValue("CryptoType", makeAny(OUString("XorEncryptedDataSpace")));
+    aResult[1] = NamedValue("Password", makeAny(rPassword));
+    aResult[2] = NamedValue("KeySalt", makeAny(aSalt));
     return aResult;
 }
 
 sal_Bool XorPackageEncryption::readEncryptionInfo(const Sequence<NamedValue>& aStreams)
 {
-    return true;
+    mbProbed = true;
+    mbProbeSucceeded = lcl_readTransformChain(
+        [&aStreams](const OUString& rStreamName) { return getStreamData(aStreams, rStreamName); },
+        maKeystream, maChain);
+
+    // Without the password a keyed package can not be probed, generateEncryptionKey checks it
+    maKeyInfo = getStreamData(aStreams, "\006DataSpaces/" KEY_INFO_STREAM);
+    Sequence<sal_Int8> aSalt;
+    Sequence<sal_Int8> aVerifier;
+    sal_Int32 nIterations;
+    mbProbeSucceeded = mbProbeSucceeded
+        && (maKeyInfo.hasElements() ? lcl_readKeyInfo(maKeyInfo, aSalt, aVerifier, nIterations)
+                                    : lcl_probeEncryptedPackage(getStreamData(aStreams, "EncryptedPackage"), maChain));
+    return mbProbeSucceeded;
 }
 
 sal_Bool XorPackageEncryption::setupEncryption(const Sequence<NamedValue>& rMediaEncData)
 {
+    OUString sPassword;
+    Sequence<sal_Int8> aSalt;
+    Sequence<OUString> aTransforms;
+    for (const auto& rValue : rMediaEncData)
+    {
+        if (rValue.Name == "DocumentSummary")
+            rValue.Value >>= mbWriteDocumentSummary;
+        else if (rValue.Name == "PartIndex")
+            rValue.Value >>= mbWritePartIndex;
+        else if (rValue.Name == "DocumentId")
+            rValue.Value >>= msDocumentId;
+        else if (rValue.Name == "Password")
+            rValue.Value >>= sPassword;
+        else if (rValue.Name == "KeySalt")
+            rValue.Value >>= aSalt;
+        else if (rValue.Name == "Transforms")
+            rValue.Value >>= aTransforms;
+    }
+
+    if (aTransforms.hasElements())
+    {
+        if (aTransforms.getLength() > MAX_TRANSFORMS)
+            return false;
+        // Built aside, a rejected list leaves the current chain alone
+        TransformChain aChain;
+        for (const auto& rName : aTransforms)
+        {
+            TransformStage aStage;
+            if (!lcl_createStage(rName, maKeystream, aStage))
+                return false;
+            aChain.append(aStage);
+        }
+        if (!lcl_hasOneKeyStage(aChain))
+            return false;
+        maChain = aChain;
+    }
+
+    maKeyInfo = Sequence<sal_Int8>();
+    maKeystream = XorKeystream(XOR_VALUE);
+    if (!sPassword.isEmpty())
+    {
+        // Stored in KeyInfo. A document opened with a password gets its KeySalt from
+        // createEncryptionData, so that its saves share one key.
+        if (aSalt.getLength() != KEY_SALT_LENGTH)
+            aSalt = lcl_randomSalt();
+
+        Sequence<sal_Int8> aKey = lcl_deriveKey(sPassword, aSalt, KEY_DERIVATION_ITERATIONS);
+        maKeyInfo = createStreamDataSpacesKeyInfo(aSalt, lcl_keyVerifier(aKey, aSalt))->getWrittenBytes();
+        maKeystream = XorKeystream(aKey);
+    }
     return true;
 }
 
+template <typename R> static void lcl_writeRecord(BinaryXOutputStream& rStream, const R& rRecord)
+{
+    PooledBuffer aBuffer(rRecord.size());
+    rRecord.serialize(aBuffer.get().getArray());
+    rStream.writeArray(reinterpret_cast<const char*>(aBuffer.get().getConstArray()), aBuffer.get().getLength());
+}
+
+Sequence<sal_Int8> XorPackageEncryption::getTransformFingerprint() const
+{
+    // The key and the stages the data went through
+    OUStringBuffer aStages;
+    for (const auto& rStage : maChain.getStages())
+        aStages.append(rStage.pId);
+    return lcl_sha1(maKeystream.getKey(), lcl_utf8(aStages.makeStringAndClear()));
+}
+
 Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesDataSpaceMap()
 {
+    TRACE_SPAN("createStreamDataSpacesDataSpaceMap");
     Reference<XOutputStream> xStream(
         mxContext->getServiceManager()->createInstanceWithContext(
             "com.sun.star.io.SequenceOutputStream", mxContext),
         UNO_QUERY);
     BinaryXOutputStream aStream(xStream);
 
-    aStream.writeInt32(8); // Header length
-    aStream.writeInt32(1); // Entries count
+    aStream.writeArray(aDataSpaceMapBytes.getData(), aDataSpaceMapBytes.size());
 
-    OUString sReferenceComponent("EncryptedPackage");
+    xStream->flush();
 
-    aStream.writeInt32(0x60); // Length
-    aStream.writeInt32(1); // References count
-    aStream.writeInt32(0); // References component type
+    Reference<XSequenceOutputStream> xSequence(xStream, UNO_QUERY);
+    return xSequence;
+}
 
-    aStream.writeInt32(sReferenceComponent.getLength() * 2);
-    aStream.writeUnicodeArray(sReferenceComponent);
-    for (int i = 0; i < sReferenceComponent.getLength() * 2 % 4; i++) // Padding
-    {
-        aStream.writeValue<sal_Char>(0);
-    }
+Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesDataSpaceInfo()
+{
+    TRACE_SPAN("createStreamDataSpacesDataSpaceInfo");
+    Reference<XOutputStream> xStream(
+        mxContext->getServiceManager()->createInstanceWithContext(
+            "com.sun.star.io.SequenceOutputStream", mxContext),
+        UNO_QUERY);
+    BinaryXOutputStream aStream(xStream);
 
-    OUString sDataSpaceName(DATASPACE_NAME);
-    aStream.writeInt32(sDataSpaceName.getLength() * 2);
-    aStream.writeUnicodeArray(sDataSpaceName);
-    for (int i = 0; i < sDataSpaceName.getLength() * 2 % 4; i++) // Padding
-    {
-        aStream.writeValue<sal_Char>(0);
-    }
+    lcl_writeRecord(aStream, makeRecord(int32(0x08), int32(maChain.getStages().size())));
+    for (const auto& rStage : maChain.getStages())
+        lcl_writeRecord(aStream, makeRecord(unicode(rStage.pName)));
 
     xStream->flush();
 
@@ -208,24 +722,33 @@ Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesDat
     return xSequence;
 }
 
-Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesDataSpaceInfo()
+Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesTransformInfo(const TransformStage& rStage)
 {
+    TRACE_SPAN("createStreamDataSpacesTransformInfo");
+    // Write 0x6DataSpaces/TransformInfo/[transformname]
     Reference<XOutputStream> xStream(
         mxContext->getServiceManager()->createInstanceWithContext(
             "com.sun.star.io.SequenceOutputStream", mxContext),
         UNO_QUERY);
     BinaryXOutputStream aStream(xStream);
 
-    aStream.writeInt32(0x08); // Header length
-    aStream.writeInt32(1); // Entries count
+    lcl_writeRecord(aStream, makeTransformInfo(rStage.pId, rStage.pTransformName));
 
-    OUString sTransformName(TRANSFORM_NAME);
-    aStream.writeInt32(sTransformName.getLength() * 2);
-    aStream.writeUnicodeArray(sTransformName);
-    for (int i = 0; i < sTransformName.getLength() * 2 % 4; i++) // Padding
-    {
-        aStream.writeValue<sal_Char>(0);
-    }
+    xStream->flush();
+
+    Reference<XSequenceOutputStream> xSequence(xStream, UNO_QUERY);
+    return xSequence;
+}
+
+Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesVersion()
+{
+    TRACE_SPAN("createStreamDataSpacesVersion");
+    Reference<XOutputStream> xStream(mxContext->getServiceManager()->createInstanceWithContext(
+        "com.sun.star.io.SequenceOutputStream", mxContext),
+        UNO_QUERY);
+    BinaryXOutputStream aStream(xStream);
+
+    aStream.writeArray(aVersionBytes.getData(), aVersionBytes.size());
 
     xStream->flush();
 
@@ -233,81 +756,632 @@ Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesDat
     return xSequence;
 }
 
-Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesTransformInfo()
+Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesKeyInfo(const Sequence<sal_Int8>& rSalt, const Sequence<sal_Int8>& rVerifier)
 {
-    // Write 0x6DataSpaces/TransformInfo/[transformname]
+    TRACE_SPAN("createStreamDataSpacesKeyInfo");
     Reference<XOutputStream> xStream(
         mxContext->getServiceManager()->createInstanceWithContext(
             "com.sun.star.io.SequenceOutputStream", mxContext),
         UNO_QUERY);
     BinaryXOutputStream aStream(xStream);
-    OUString sTransformId("{C73DFACD-061F-43B0-8B64-AC620D2A8B50}");
 
-    // MS-OFFCRYPTO 2.1.8: TransformInfoHeader
-    sal_uInt32 nLength
-        = sTransformId.getLength() * 2 + ((4 - (sTransformId.getLength() & 3)) & 3) + 10;
-    aStream.writeInt32(nLength); // TransformLength, will be written later
-    aStream.writeInt32(1); // TransformType
+    aStream.writeInt32(KEY_INFO_VERSION);
+    aStream.writeInt32(KEY_DERIVATION_ITERATIONS);
+    aStream.writeInt32(rSalt.getLength());
+    aStream.writeArray(reinterpret_cast<const char*>(rSalt.getConstArray()), rSalt.getLength());
+    aStream.writeInt32(rVerifier.getLength());
+    aStream.writeArray(reinterpret_cast<const char*>(rVerifier.getConstArray()), rVerifier.getLength());
 
-    // TransformId
-    aStream.writeInt32(sTransformId.getLength() * 2);
-    aStream.writeUnicodeArray(sTransformId);
-    for (int i = 0; i < sTransformId.getLength() * 2 % 4; i++) // Padding
+    xStream->flush();
+
+    Reference<XSequenceOutputStream> xSequence(xStream, UNO_QUERY);
+    return xSequence;
+}
+
+// DocumentSummary and PartIndex, since version 2: a cleartext header, then the stream as
+// version 1 wrote it, encrypted with the document's transform chain
+static Sequence<sal_Int8> lcl_sealStream(const Sequence<sal_Int8>& rBody, const TransformChain& rChain)
+{
+    Sequence<sal_Int8> aStream(SEALED_STREAM_HEADER_LENGTH + rBody.getLength());
+    sal_Int8* p = aStream.getArray();
+    p = int32(SEALED_STREAM_HEADER_LENGTH).serialize(p);
+    p = int32(SEALED_STREAM_VERSION).serialize(p);
+    p = int32(0).serialize(p); // Reserved
+    memcpy(p, rBody.getConstArray(), rBody.getLength());
+    rChain.encrypt(p, rBody.getLength(), 0);
+    return aStream;
+}
+
+// Decrypted body of a sealed stream. A version 1 stream is returned as it is, with rbSealed false.
+static Sequence<sal_Int8> lcl_unsealStream(const Sequence<sal_Int8>& rStream, const TransformChain& rChain, bool& rbSealed)
+{
+    RecordReader aReader(rStream);
+    sal_Int32 nHeaderLength = 0;
+    sal_Int32 nVersion = 0;
+    rbSealed = aReader.readInt32(nHeaderLength) && nHeaderLength == SEALED_STREAM_HEADER_LENGTH;
+    if (!rbSealed)
+        return rStream;
+    if (!aReader.readInt32(nVersion) || nVersion != SEALED_STREAM_VERSION || !aReader.take(4))
+        return Sequence<sal_Int8>();
+
+    Sequence<sal_Int8> aBody(rStream.getConstArray() + SEALED_STREAM_HEADER_LENGTH,
+                             rStream.getLength() - SEALED_STREAM_HEADER_LENGTH);
+    rChain.decrypt(aBody.getArray(), aBody.getLength(), 0);
+    return aBody;
+}
+
+Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesDocumentSummary(const Reference<XInputStream>& rxInputStream)
+{
+    TRACE_SPAN("createStreamDataSpacesDocumentSummary");
+    // Document properties and thumbnail on their own, so that they can be listed without
+    // decrypting the package. encryptPackage seals the stream with the document key.
+    Sequence<Any> aArguments(1);
+    aArguments[0] <<= rxInputStream;
+    Reference<XNameAccess> xPackage(
+        mxContext->getServiceManager()->createInstanceWithArgumentsAndContext(
+            "com.sun.star.packages.zip.ZipFileAccess", aArguments, mxContext),
+        UNO_QUERY_THROW);
+
+    map<OUString, Sequence<sal_Int8>> aEntries;
+    for (const auto& sName : xPackage->getElementNames())
     {
-        aStream.writeValue<sal_Char>(0);
+        if (sName != "docProps/core.xml" && !sName.startsWith("docProps/thumbnail."))
+            continue;
+
+        Reference<XInputStream> xEntry(xPackage->getByName(sName), UNO_QUERY_THROW);
+        Sequence<sal_Int8> aData;
+        Sequence<sal_Int8> aChunk;
+        while (xEntry->readBytes(aChunk, TRANSFORM_CHUNK_SIZE) > 0)
+        {
+            sal_Int32 nOldLength = aData.getLength();
+            aData.realloc(nOldLength + aChunk.getLength());
+            memcpy(aData.getArray() + nOldLength, aChunk.getConstArray(), aChunk.getLength());
+        }
+        aEntries.insert({ sName, aData });
     }
 
-    // TransformName
-    OUString sTransformInfoName("Microsoft.Metadata.XorTransform");
-    aStream.writeInt32(sTransformInfoName.getLength() * 2);
-    aStream.writeUnicodeArray(sTransformInfoName);
-    for (int i = 0; i < sTransformInfoName.getLength() * 2 % 4; i++) // Padding
+    // The package itself is encrypted from the start
+    Reference<XSeekable>(rxInputStream, UNO_QUERY_THROW)->seek(0);
+
+    Reference<XOutputStream> xStream(mxContext->getServiceManager()->createInstanceWithContext(
+        "com.sun.star.io.SequenceOutputStream", mxContext),
+        UNO_QUERY);
+    BinaryXOutputStream aStream(xStream);
+
+    aStream.writeInt32(8); // Header length
+    aStream.writeInt32(aEntries.size()); // Entries count
+    for (auto& rEntry : aEntries)
     {
-        aStream.writeValue<sal_Char>(0);
-    }
+        aStream.writeInt32(rEntry.first.getLength() * 2);
+        aStream.writeUnicodeArray(rEntry.first);
+        for (int i = 0; i < rEntry.first.getLength() * 2 % 4; i++) // Padding
+        {
+            aStream.writeValue<sal_Char>(0);
+        }
 
-    aStream.writeInt32(1); // ReaderVersion
-    aStream.writeInt32(1); // UpdateVersion
-    aStream.writeInt32(1); // WriterVersion
+        const Sequence<sal_Int8>& rData = rEntry.second;
+        aStream.writeInt32(rData.getLength());
+        xStream->writeBytes(rData);
+        for (int i = 0; i < (4 - (rData.getLength() & 3)) % 4; i++) // Padding
+        {
+            aStream.writeValue<sal_Char>(0);
+        }
+    }
 
-    aStream.writeInt32(4); // Extensibility Header
     xStream->flush();
 
     Reference<XSequenceOutputStream> xSequence(xStream, UNO_QUERY);
     return xSequence;
 }
 
-Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesVersion()
+static Sequence<NamedValue> lcl_readDocumentSummary(const Sequence<sal_Int8>& rStream, const TransformChain& rChain)
+{
+    bool bSealed = false;
+    const Sequence<sal_Int8> aBody = lcl_unsealStream(rStream, rChain, bSealed);
+    RecordReader aReader(aBody);
+    sal_Int32 nHeaderLength = 0;
+    sal_Int32 nEntries = 0;
+    if (!aReader.readInt32(nHeaderLength) || !aReader.readInt32(nEntries) || nHeaderLength != 8
+        || nEntries < 0 || nEntries > aReader.getRemaining())
+        return Sequence<NamedValue>();
+
+    Sequence<NamedValue> aEntries(nEntries);
+    for (auto& rEntry : aEntries)
+    {
+        UnicodeView aName;
+        UnicodeField::parse(aReader, aName);
+        sal_Int32 nSize = 0;
+        aReader.readInt32(nSize);
+        const sal_Int8* pData = aReader.take(nSize);
+        aReader.take((4 - (nSize & 3)) % 4);
+        if (!aReader.isValid())
+            return Sequence<NamedValue>();
+
+        Sequence<sal_Int8> aData(pData, nSize);
+        // Version 1 encrypted every entry with the default key
+        if (!bSealed)
+            xorTransform(aData.getArray(), nSize, XOR_VALUE);
+        rEntry = NamedValue(aName.toString(), makeAny(aData));
+    }
+    return aEntries;
+}
+
+Reference<XNameAccess> XorPackageEncryption::openContainer(const Reference<XInputStream>& rxContainer)
+{
+    // No temporary copy: only the requested streams are read from the container
+    Sequence<Any> aArguments(2);
+    aArguments[0] <<= rxContainer;
+    aArguments[1] <<= true;
+    Reference<XNameAccess> xStorage(
+        mxContext->getServiceManager()->createInstanceWithArgumentsAndContext(
+            "com.sun.star.embed.OLESimpleStorage", aArguments, mxContext),
+        UNO_QUERY_THROW);
+    return xStorage;
+}
+
+static Reference<XInputStream> lcl_openContainerStream(Reference<XNameAccess> xStorage, const OUString& sStreamName)
+{
+    sal_Int32 nStart = 0;
+    for (sal_Int32 nEnd = sStreamName.indexOf('/'); nEnd >= 0; nEnd = sStreamName.indexOf('/', nStart))
+    {
+        OUString sStorageName = sStreamName.copy(nStart, nEnd - nStart);
+        if (!xStorage->hasByName(sStorageName))
+            return nullptr;
+        xStorage.set(xStorage->getByName(sStorageName), UNO_QUERY_THROW);
+        nStart = nEnd + 1;
+    }
+
+    OUString sName = sStreamName.copy(nStart);
+    if (!xStorage->hasByName(sName))
+        return nullptr;
+
+    Reference<XInputStream> xStream(xStorage->getByName(sName), UNO_QUERY_THROW);
+    return xStream;
+}
+
+static Sequence<sal_Int8> lcl_readStream(const Reference<XInputStream>& xStream)
+{
+    Sequence<sal_Int8> aData;
+    if (xStream.is())
+    {
+        BinaryXInputStream aBinaryInputStream(xStream);
+        xStream->readBytes(aData, aBinaryInputStream.size());
+    }
+    return aData;
+}
+
+static Sequence<sal_Int8> lcl_readStreamRange(const Reference<XInputStream>& xStream, sal_Int64 nOffset, sal_Int32 nSize)
+{
+    Reference<XSeekable>(xStream, UNO_QUERY_THROW)->seek(nOffset);
+    Sequence<sal_Int8> aData;
+    if (xStream->readBytes(aData, nSize) != nSize)
+        throw RuntimeException("stream read: range was not read completely");
+    return aData;
+}
+
+static void lcl_putUInt16(sal_Int8* p, sal_uInt16 nValue)
+{
+    p[0] = static_cast<sal_Int8>(nValue & 0xFF);
+    p[1] = static_cast<sal_Int8>(nValue >> 8);
+}
+
+static void lcl_putUInt32(sal_Int8* p, sal_uInt32 nValue)
+{
+    lcl_putUInt16(p, nValue & 0xFFFF);
+    lcl_putUInt16(p + 2, nValue >> 16);
+}
+
+namespace
 {
+// Location of a ZIP entry in the package, see createStreamDataSpacesPartIndex
+struct PartLocation
+{
+    OUString sName;
+    sal_Int32 nLocalOffset;
+    sal_Int32 nLocalSize;
+    sal_Int32 nCentralOffset;
+    sal_Int32 nCentralSize;
+};
+}
+
+static bool lcl_readZipDirectory(const Reference<XInputStream>& rxInputStream, vector<PartLocation>& rParts)
+{
+    const sal_Int32 nEndRecordSize = 22;
+    const sal_Int32 nMaxCommentSize = 0xFFFF;
+
+    BinaryXInputStream aInputStream(rxInputStream);
+    const sal_Int64 nSize = aInputStream.size();
+    if (nSize < nEndRecordSize)
+        return false;
+
+    const sal_Int32 nTailSize = std::min<sal_Int64>(nSize, nEndRecordSize + nMaxCommentSize);
+    Sequence<sal_Int8> aTail = lcl_readStreamRange(rxInputStream, nSize - nTailSize, nTailSize);
+
+    sal_Int32 nDirectorySize = -1;
+    sal_Int32 nDirectoryOffset = -1;
+    for (sal_Int32 nPos = nTailSize - nEndRecordSize; nPos >= 0; nPos--)
+    {
+        RecordReader aReader(aTail.getConstArray() + nPos, nEndRecordSize);
+        sal_Int32 nSignature = 0;
+        if (!aReader.readInt32(nSignature) || nSignature != 0x06054b50) // PK\x05\x06
+            continue;
+        aReader.take(8);
+        aReader.readInt32(nDirectorySize);
+        aReader.readInt32(nDirectoryOffset);
+        break;
+    }
+    // Zip64 packages do not fit the 32 bit index
+    if (nDirectorySize < 0 || nDirectoryOffset < 0 || sal_Int64(nDirectoryOffset) + nDirectorySize > nSize)
+        return false;
+
+    Sequence<sal_Int8> aDirectory = lcl_readStreamRange(rxInputStream, nDirectoryOffset, nDirectorySize);
+    RecordReader aReader(aDirectory);
+    while (aReader.getRemaining() > 0)
+    {
+        const sal_Int32 nCentralOffset = nDirectorySize - aReader.getRemaining();
+        sal_Int32 nSignature = 0;
+        sal_uInt16 nNameLength = 0, nExtraLength = 0, nCommentLength = 0;
+        sal_Int32 nLocalOffset = 0;
+        aReader.readInt32(nSignature);
+        aReader.take(24);
+        aReader.readUInt16(nNameLength);
+        aReader.readUInt16(nExtraLength);
+        aReader.readUInt16(nCommentLength);
+        aReader.take(8);
+        aReader.readInt32(nLocalOffset);
+        const sal_Int8* pName = aReader.take(nNameLength);
+        aReader.take(nExtraLength + nCommentLength);
+        if (!aReader.isValid() || nSignature != 0x02014b50 || nLocalOffset < 0) // PK\x01\x02
+            return false;
+
+        PartLocation aPart;
+        aPart.sName = OStringToOUString(OString(reinterpret_cast<const sal_Char*>(pName), nNameLength), RTL_TEXTENCODING_UTF8);
+        aPart.nLocalOffset = nLocalOffset;
+        aPart.nCentralOffset = nDirectoryOffset + nCentralOffset;
+        aPart.nCentralSize = nDirectorySize - aReader.getRemaining() - nCentralOffset;
+        rParts.push_back(aPart);
+    }
+
+    // An entry extends up to the next local header, or the central directory for the last one
+    vector<sal_Int32> aOffsets;
+    for (const auto& rPart : rParts)
+        aOffsets.push_back(rPart.nLocalOffset);
+    aOffsets.push_back(nDirectoryOffset);
+    std::sort(aOffsets.begin(), aOffsets.end());
+    for (auto& rPart : rParts)
+        rPart.nLocalSize = *std::upper_bound(aOffsets.begin(), aOffsets.end(), rPart.nLocalOffset) - rPart.nLocalOffset;
+
+    return true;
+}
+
+Reference<XSequenceOutputStream> XorPackageEncryption::createStreamDataSpacesPartIndex(const Reference<XInputStream>& rxInputStream)
+{
+    TRACE_SPAN("createStreamDataSpacesPartIndex");
+    // Where every part of the package is, so that it can be decrypted on its own.
+    // encryptPackage seals the stream with the document key.
+    vector<PartLocation> aParts;
+    if (!lcl_readZipDirectory(rxInputStream, aParts))
+        aParts.clear();
+    Reference<XSeekable>(rxInputStream, UNO_QUERY_THROW)->seek(0);
+
     Reference<XOutputStream> xStream(mxContext->getServiceManager()->createInstanceWithContext(
         "com.sun.star.io.SequenceOutputStream", mxContext),
         UNO_QUERY);
     BinaryXOutputStream aStream(xStream);
 
-    OUString sFeatureIdentifier("Microsoft.Container.DataSpaces");
-    aStream.writeInt32(sFeatureIdentifier.getLength() * 2);
-    aStream.writeUnicodeArray(sFeatureIdentifier);
-    for (int i = 0; i < sFeatureIdentifier.getLength() * 2 % 4; i++) // Padding
+    aStream.writeInt32(8); // Header length
+    aStream.writeInt32(aParts.size()); // Entries count
+    for (const auto& rPart : aParts)
     {
-        aStream.writeValue<sal_Char>(0);
+        aStream.writeInt32(rPart.sName.getLength() * 2);
+        aStream.writeUnicodeArray(rPart.sName);
+        for (int i = 0; i < rPart.sName.getLength() * 2 % 4; i++) // Padding
+        {
+            aStream.writeValue<sal_Char>(0);
+        }
+        aStream.writeInt32(rPart.nLocalOffset);
+        aStream.writeInt32(rPart.nLocalSize);
+        aStream.writeInt32(rPart.nCentralOffset);
+        aStream.writeInt32(rPart.nCentralSize);
     }
 
-    aStream.writeInt32(1); // Reader version
-    aStream.writeInt32(1); // Updater version
-    aStream.writeInt32(1); // Writer version
-
     xStream->flush();
 
     Reference<XSequenceOutputStream> xSequence(xStream, UNO_QUERY);
     return xSequence;
 }
 
-Sequence<NamedValue> XorPackageEncryption::encrypt(const Reference<XInputStream>& rxInputStream)
+static bool lcl_findPart(const Sequence<sal_Int8>& rPartIndex, const OUString& rPartName, PartLocation& rPart)
 {
-    // Store all streams into sequence and return back
-    Sequence<NamedValue> aStreams(5);
+    RecordReader aReader(rPartIndex);
+    sal_Int32 nHeaderLength = 0;
+    sal_Int32 nEntries = 0;
+    if (!aReader.readInt32(nHeaderLength) || !aReader.readInt32(nEntries) || nHeaderLength != 8)
+        return false;
+
+    for (sal_Int32 i = 0; i < nEntries && aReader.isValid(); i++)
+    {
+        UnicodeView aName;
+        UnicodeField::parse(aReader, aName);
+        aReader.readInt32(rPart.nLocalOffset);
+        aReader.readInt32(rPart.nLocalSize);
+        aReader.readInt32(rPart.nCentralOffset);
+        aReader.readInt32(rPart.nCentralSize);
+        if (aReader.isValid() && aName.toString() == rPartName)
+        {
+            rPart.sName = rPartName;
+            return rPart.nLocalSize >= 0 && rPart.nCentralSize >= 46;
+        }
+    }
+    return false;
+}
+
+Sequence<sal_Int8> XorPackageEncryption::readPart(const Reference<XInputStream>& rxContainer, const OUString& rPartName,
+                                                  const OUString& rPassword)
+{
+    Reference<XNameAccess> xStorage = openContainer(rxContainer);
+
+    XorKeystream aKeystream(XOR_VALUE);
+    TransformChain aChain;
+    if (!lcl_unlockTransformChain(
+            [&xStorage](const OUString& rStreamName) { return lcl_readStream(lcl_openContainerStream(xStorage, rStreamName)); },
+            rPassword, aKeystream, aChain))
+        throw lang::IllegalArgumentException("wrong Password", static_cast<cppu::OWeakObject*>(this), 0);
+
+    bool bSealed = false;
+    PartLocation aPart;
+    if (!lcl_findPart(lcl_unsealStream(lcl_readStream(lcl_openContainerStream(xStorage, "\006DataSpaces/" PART_INDEX_STREAM)),
+                                       aChain, bSealed),
+                      rPartName, aPart))
+        return Sequence<sal_Int8>();
+
+    // Decrypt just the local entry and its central directory record
+    Reference<XInputStream> xEncryptedPackage = lcl_openContainerStream(xStorage, "EncryptedPackage");
+    if (!xEncryptedPackage.is())
+        return Sequence<sal_Int8>();
+    Sequence<sal_Int8> aLocal = lcl_readStreamRange(xEncryptedPackage, sizeof(sal_Int64) + aPart.nLocalOffset, aPart.nLocalSize);
+    Sequence<sal_Int8> aCentral = lcl_readStreamRange(xEncryptedPackage, sizeof(sal_Int64) + aPart.nCentralOffset, aPart.nCentralSize);
+    aChain.decrypt(aLocal.getArray(), aLocal.getLength(), aPart.nLocalOffset);
+    aChain.decrypt(aCentral.getArray(), aCentral.getLength(), aPart.nCentralOffset);
+
+    // Wrap them into a package of their own and let the ZIP implementation inflate the part
+    const sal_Int32 nEndRecordSize = 22;
+    Sequence<sal_Int8> aZip(aLocal.getLength() + aCentral.getLength() + nEndRecordSize);
+    sal_Int8* p = aZip.getArray();
+    memcpy(p, aLocal.getConstArray(), aLocal.getLength());
+    p += aLocal.getLength();
+    memcpy(p, aCentral.getConstArray(), aCentral.getLength());
+    lcl_putUInt32(p + 42, 0); // Local header offset
+    p += aCentral.getLength();
+    memset(p, 0, nEndRecordSize);
+    lcl_putUInt32(p, 0x06054b50); // PK\x05\x06
+    lcl_putUInt16(p + 8, 1); // Entries on this disk
+    lcl_putUInt16(p + 10, 1); // Entries
+    lcl_putUInt32(p + 12, aCentral.getLength()); // Central directory size
+    lcl_putUInt32(p + 16, aLocal.getLength()); // Central directory offset
+
+    Sequence<Any> aArguments(1);
+    aArguments[0] <<= SequenceInputStream::createStreamFromSequence(mxContext, aZip);
+    Reference<XNameAccess> xPart(
+        mxContext->getServiceManager()->createInstanceWithArgumentsAndContext(
+            "com.sun.star.packages.zip.ZipFileAccess", aArguments, mxContext),
+        UNO_QUERY_THROW);
+    Reference<XInputStream> xPartStream(xPart->getByName(rPartName), UNO_QUERY_THROW);
+
+    Sequence<sal_Int8> aData;
+    Sequence<sal_Int8> aChunk;
+    while (xPartStream->readBytes(aChunk, TRANSFORM_CHUNK_SIZE) > 0)
+    {
+        sal_Int32 nOldLength = aData.getLength();
+        aData.realloc(nOldLength + aChunk.getLength());
+        memcpy(aData.getArray() + nOldLength, aChunk.getConstArray(), aChunk.getLength());
+    }
+    return aData;
+}
+
+bool XorPackageEncryption::rekeyFile(const OUString& rURL, const OUString& rOldPassword, const OUString& rNewPassword)
+{
+    Reference<ucb::XSimpleFileAccess3> xFileAccess(ucb::SimpleFileAccess::create(mxContext));
+    Sequence<Any> aArguments(2);
+    aArguments[0] <<= xFileAccess->openFileReadWrite(rURL);
+    aArguments[1] <<= false;
+    Reference<XNameContainer> xStorage(
+        mxContext->getServiceManager()->createInstanceWithArgumentsAndContext(
+            "com.sun.star.embed.OLESimpleStorage", aArguments, mxContext),
+        UNO_QUERY_THROW);
+    if (!xStorage->hasByName("\006DataSpaces") || !xStorage->hasByName("EncryptedPackage"))
+        return false;
+    Reference<XNameContainer> xDataSpaces(xStorage->getByName("\006DataSpaces"), UNO_QUERY_THROW);
+
+    // Only the key stage changes. The other stages are XOR masks too, so they commute
+    // with it and stay in place on the ciphertext.
+    XorKeystream aOldKeystream(XOR_VALUE);
+    TransformChain aChain;
+    if (!lcl_readTransformChain(
+            [&xStorage](const OUString& rStreamName) { return lcl_readStream(lcl_openContainerStream(xStorage, rStreamName)); },
+            aOldKeystream, aChain))
+        return false;
+
+    if (!lcl_unlockKeystream(lcl_readStream(lcl_openContainerStream(xStorage, "\006DataSpaces/" KEY_INFO_STREAM)),
+                             rOldPassword, aOldKeystream))
+        return false;
+
+    XorKeystream aNewKeystream(XOR_VALUE);
+    Sequence<sal_Int8> aNewKeyInfo;
+    if (!rNewPassword.isEmpty())
+    {
+        Sequence<sal_Int8> aSalt = lcl_randomSalt();
+        Sequence<sal_Int8> aKey = lcl_deriveKey(rNewPassword, aSalt, KEY_DERIVATION_ITERATIONS);
+        aNewKeyInfo = createStreamDataSpacesKeyInfo(aSalt, lcl_keyVerifier(aKey, aSalt))->getWrittenBytes();
+        aNewKeystream = XorKeystream(aKey);
+    }
+
+    // One pass over the ciphertext with both keystreams at once: the plaintext never exists
+    const XorKeystream aRekey = XorKeystream::combine(aOldKeystream, aNewKeystream);
+    Reference<XInputStream> xOldPackage(xStorage->getByName("EncryptedPackage"), UNO_QUERY_THROW);
+    BinaryXInputStream aOldPackage(xOldPackage);
+    const sal_Int64 nSize = aOldPackage.readInt64();
+
+    Reference<XOutputStream> xNewPackage(mxContext->getServiceManager()->createInstanceWithContext(
+        "com.sun.star.io.SequenceOutputStream", mxContext),
+        UNO_QUERY);
+    BinaryXOutputStream aNewPackage(xNewPackage);
+    aNewPackage.writeInt64(nSize);
+
+    TransformTuner::get().run(xOldPackage, xNewPackage, aOldPackage.size() - sizeof(sal_Int64),
+        [&aRekey](sal_Int8* pData, sal_Int32 nDataSize, sal_Int64 nOffset) { aRekey.apply(pData, nDataSize, nOffset); });
+    xNewPackage->flush();
+
+    Reference<XSequenceOutputStream> xNewPackageSequence(xNewPackage, UNO_QUERY);
+    xStorage->replaceByName("EncryptedPackage",
+        makeAny(SequenceInputStream::createStreamFromSequence(mxContext, xNewPackageSequence->getWrittenBytes())));
+
+    // Sealed streams are encrypted with the key stage too
+    for (const char* pStreamName : { DOCUMENT_SUMMARY_STREAM, PART_INDEX_STREAM })
+    {
+        Sequence<sal_Int8> aStream = lcl_readStream(lcl_openContainerStream(xDataSpaces, OUString::createFromAscii(pStreamName)));
+        RecordReader aReader(aStream);
+        sal_Int32 nHeaderLength = 0;
+        if (!aReader.readInt32(nHeaderLength) || nHeaderLength != SEALED_STREAM_HEADER_LENGTH)
+            continue;
+        aRekey.apply(aStream.getArray() + SEALED_STREAM_HEADER_LENGTH, aStream.getLength() - SEALED_STREAM_HEADER_LENGTH, 0);
+        xDataSpaces->replaceByName(OUString::createFromAscii(pStreamName),
+                                   makeAny(SequenceInputStream::createStreamFromSequence(mxContext, aStream)));
+    }
+
+    if (xDataSpaces->hasByName(KEY_INFO_STREAM))
+        xDataSpaces->removeByName(KEY_INFO_STREAM);
+    if (aNewKeyInfo.hasElements())
+        xDataSpaces->insertByName(KEY_INFO_STREAM, makeAny(SequenceInputStream::createStreamFromSequence(mxContext, aNewKeyInfo)));
+    xStorage->replaceByName("\006DataSpaces", makeAny(xDataSpaces));
+
+    Reference<embed::XTransactedObject>(xStorage, UNO_QUERY_THROW)->commit();
+    return true;
+}
+
+Any SAL_CALL XorPackageEncryption::execute(const Sequence<NamedValue>& rArguments)
+{
+    OUString sCommand;
+    Reference<XInputStream> xInputStream;
+    Sequence<NamedValue> aStreams;
+    OUString sPartName;
+    OUString sPassword;
+    OUString sNewPassword;
+    Sequence<OUString> aURLs;
+    Sequence<Reference<XInputStream>> aInputStreams;
+    Sequence<NamedValue> aEncryptionData;
+    for (const auto& rArgument : rArguments)
+    {
+        if (rArgument.Name == "Command")
+            rArgument.Value >>= sCommand;
+        else if (rArgument.Name == "InputStream")
+            rArgument.Value >>= xInputStream;
+        else if (rArgument.Name == "Streams")
+            rArgument.Value >>= aStreams;
+        else if (rArgument.Name == "PartName")
+            rArgument.Value >>= sPartName;
+        else if (rArgument.Name == "Password")
+            rArgument.Value >>= sPassword;
+        else if (rArgument.Name == "NewPassword")
+            rArgument.Value >>= sNewPassword;
+        else if (rArgument.Name == "URLs")
+            rArgument.Value >>= aURLs;
+        else if (rArgument.Name == "InputStreams")
+            rArgument.Value >>= aInputStreams;
+        else if (rArgument.Name == "EncryptionData")
+            rArgument.Value >>= aEncryptionData;
+    }
+
+    if (sCommand == "ReadDocumentSummary")
+    {
+        StreamReader aReadStream;
+        if (xInputStream.is())
+        {
+            Reference<XNameAccess> xStorage = openContainer(xInputStream);
+            aReadStream = [xStorage](const OUString& rStreamName) { return lcl_readStream(lcl_openContainerStream(xStorage, rStreamName)); };
+        }
+        else
+        {
+            aReadStream = [&aStreams](const OUString& rStreamName) { return getStreamData(aStreams, rStreamName); };
+        }
+
+        XorKeystream aKeystream(XOR_VALUE);
+        TransformChain aChain;
+        if (!lcl_unlockTransformChain(aReadStream, sPassword, aKeystream, aChain))
+            throw lang::IllegalArgumentException("wrong Password", static_cast<cppu::OWeakObject*>(this), 0);
+        return makeAny(lcl_readDocumentSummary(aReadStream("\006DataSpaces/" DOCUMENT_SUMMARY_STREAM), aChain));
+    }
+    else if (sCommand == "ReadPart")
+    {
+        if (!xInputStream.is())
+            throw lang::IllegalArgumentException("ReadPart needs an InputStream", static_cast<cppu::OWeakObject*>(this), 0);
+        return makeAny(readPart(xInputStream, sPartName, sPassword));
+    }
+    else if (sCommand == "Rekey")
+    {
+        // Every file on its own: one that can not be re-keyed does not stop the batch
+        Sequence<sal_Bool> aResults(aURLs.getLength());
+        for (sal_Int32 i = 0; i < aURLs.getLength(); i++)
+        {
+            try
+            {
+                aResults[i] = rekeyFile(aURLs[i], sPassword, sNewPassword);
+            }
+            catch (const Exception&)
+            {
+                aResults[i] = false;
+            }
+        }
+        return makeAny(aResults);
+    }
+    else if (sCommand == "EncryptBatch")
+    {
+        if (aEncryptionData.hasElements() && !setupEncryption(aEncryptionData))
+            throw lang::IllegalArgumentException("EncryptBatch: invalid EncryptionData", static_cast<cppu::OWeakObject*>(this), 0);
+        return makeAny(encryptBatch(aInputStreams));
+    }
+    else if (sCommand == "GetEngineParameters")
+    {
+        std::vector<TransformTuner::Profile> aProfiles = TransformTuner::get().getProfiles();
+        Sequence<NamedValue> aParameters(aProfiles.size() + 1);
+        aParameters[0] = NamedValue("Workers", makeAny(TransformTuner::get().getWorkerCount()));
+        for (size_t i = 0; i < aProfiles.size(); i++)
+        {
+            Sequence<NamedValue> aProfile(4);
+            aProfile[0] = NamedValue("ChunkSize", makeAny(aProfiles[i].aCurrent.nChunkSize));
+            aProfile[1] = NamedValue("Parallelism", makeAny(aProfiles[i].aCurrent.nParallelism));
+            aProfile[2] = NamedValue("Throughput", makeAny(aProfiles[i].fThroughput));
+            aProfile[3] = NamedValue("Runs", makeAny(aProfiles[i].nRuns));
+            aParameters[i + 1] = NamedValue(aProfiles[i].sName, makeAny(aProfile));
+        }
+        return makeAny(aParameters);
+    }
+    else if (sCommand == "WarmUp")
+    {
+        warmUp();
+        return Any();
+    }
+
+    throw lang::IllegalArgumentException("unknown command: " + sCommand, static_cast<cppu::OWeakObject*>(this), 0);
+}
+
+Sequence<NamedValue> XorPackageEncryption::createDataSpacesStreams()
+{
+    // Nothing in them depends on the key, so with the default chain every save writes the same streams
+    static std::mutex aDefaultStreamsMutex;
+    static Sequence<NamedValue> aDefaultStreams;
+    const sal_Int32 nStages = maChain.getStages().size();
+    const bool bDefaultChain = nStages == 1 && !strcmp(maChain.getStages()[0].pName, TRANSFORM_NAME);
+    if (bDefaultChain)
+    {
+        std::lock_guard<std::mutex> aGuard(aDefaultStreamsMutex);
+        if (aDefaultStreams.hasElements())
+            return aDefaultStreams;
+    }
 
     // Some MS specific streams sued in real encryption types. Create them like real
+    Sequence<NamedValue> aStreams(3 + nStages);
+
     aStreams[0] = NamedValue("\006DataSpaces/DataSpaceMap", 
         makeAny(createStreamDataSpacesDataSpaceMap()->getWrittenBytes()));
 
@@ -318,9 +1392,56 @@ Sequence<NamedValue> XorPackageEncryption::encrypt(const Reference<XInputStream>
     aStreams[2] = NamedValue(sStreamName, 
         makeAny(createStreamDataSpacesDataSpaceInfo()->getWrittenBytes()));
 
-    sStreamName = "\006DataSpaces/TransformInfo/" + OUString(TRANSFORM_NAME) + "/\006Primary";
-    aStreams[3] = NamedValue(sStreamName, 
-        makeAny(createStreamDataSpacesTransformInfo()->getWrittenBytes()));
+    for (sal_Int32 i = 0; i < nStages; i++)
+    {
+        const TransformStage& rStage = maChain.getStages()[i];
+        sStreamName = "\006DataSpaces/TransformInfo/" + OUString::createFromAscii(rStage.pName) + "/\006Primary";
+        aStreams[3 + i] = NamedValue(sStreamName,
+            makeAny(createStreamDataSpacesTransformInfo(rStage)->getWrittenBytes()));
+    }
+
+    if (bDefaultChain)
+    {
+        std::lock_guard<std::mutex> aGuard(aDefaultStreamsMutex);
+        aDefaultStreams = aStreams;
+    }
+    return aStreams;
+}
+
+void XorPackageEncryption::warmUp()
+{
+    // Also starts the worker pool. Buffers are not allocated ahead: they are cached per
+    // thread, and the thread that saves allocates its own on the first save.
+    TransformTuner::get();
+    createDataSpacesStreams();
+}
+
+Sequence<NamedValue> XorPackageEncryption::encryptPackage(const Sequence<NamedValue>& rDataSpaces,
+                                                          const Reference<XInputStream>& rxInputStream,
+                                                          const OUString& rDocumentId)
+{
+    // Store all streams into sequence and return back
+    const sal_Int32 nDataSpaces = rDataSpaces.getLength();
+    Sequence<NamedValue> aStreams(nDataSpaces + 1 + mbWriteDocumentSummary + mbWritePartIndex);
+    sal_Int32 nOptionalStream = nDataSpaces + 1;
+    if (maKeyInfo.hasElements())
+        aStreams.realloc(aStreams.getLength() + 1);
+    std::copy(rDataSpaces.begin(), rDataSpaces.end(), aStreams.getArray());
+
+    if (mbWriteDocumentSummary)
+    {
+        aStreams[nOptionalStream++] = NamedValue("\006DataSpaces/" DOCUMENT_SUMMARY_STREAM,
+            makeAny(lcl_sealStream(createStreamDataSpacesDocumentSummary(rxInputStream)->getWrittenBytes(), maChain)));
+    }
+
+    if (maKeyInfo.hasElements())
+        aStreams[nOptionalStream++] = NamedValue("\006DataSpaces/" KEY_INFO_STREAM, makeAny(maKeyInfo));
+
+    if (mbWritePartIndex)
+    {
+        aStreams[nOptionalStream++] = NamedValue("\006DataSpaces/" PART_INDEX_STREAM,
+            makeAny(lcl_sealStream(createStreamDataSpacesPartIndex(rxInputStream)->getWrittenBytes(), maChain)));
+    }
 
     // Create EncryptedPackage
     BinaryXInputStream aInputStream(rxInputStream);
@@ -332,24 +1453,90 @@ Sequence<NamedValue> XorPackageEncryption::encrypt(const Reference<XInputStream>
     aEncryptedPackage.writeInt64(aInputStream.size()); // Stream size
 
     // "Very serious encryption" by itself
-    for (int i=0;i<aInputStream.size();i++)
-    {
-        sal_Char byte = aInputStream.readValue<sal_Char>();
-        byte ^= XOR_VALUE;
-        aEncryptedPackage.writeValue<sal_Char>(byte);
-    }
+    TransformFunction aTransform
+        = [this](sal_Int8* pData, sal_Int32 nSize, sal_Int64 nOffset) { maChain.encrypt(pData, nSize, nOffset); };
+
+    // Shown in the frame that started the save
+    SaveProgress aProgress(rDocumentId, aInputStream.size());
+    TransformTuner::get().run(rxInputStream, xEncryptedPackage, aInputStream.size(), aTransform, 0,
+                              aProgress.getFunction());
 
     xEncryptedPackage->flush();
     Reference<XSequenceOutputStream> xEncryptedPackageSequence(xEncryptedPackage, UNO_QUERY);
 
-    aStreams[4] = NamedValue("EncryptedPackage", makeAny(xEncryptedPackageSequence->getWrittenBytes()));
+    aStreams[nDataSpaces] = NamedValue("EncryptedPackage", makeAny(xEncryptedPackageSequence->getWrittenBytes()));
 
     return aStreams;
 }
 
-sal_Bool XorPackageEncryption::generateEncryptionKey(const OUString& /*password*/)
+Sequence<NamedValue> XorPackageEncryption::encrypt(const Reference<XInputStream>& rxInputStream)
 {
-    return true;
+    TRACE_SPAN("encrypt");
+    return encryptPackage(createDataSpacesStreams(), rxInputStream, msDocumentId);
+}
+
+Sequence<Sequence<NamedValue>> XorPackageEncryption::encryptBatch(const Sequence<Reference<XInputStream>>& rInputStreams)
+{
+    TRACE_SPAN("encryptBatch");
+    // The DataSpaces streams are the same for every document of the batch
+    const Sequence<NamedValue> aDataSpaces = createDataSpacesStreams();
+
+    Sequence<Sequence<NamedValue>> aResults(rInputStreams.getLength());
+    Sequence<NamedValue>* pResults = aResults.getArray();
+
+    // A few documents at a time: while one of them reads or writes its streams, the
+    // chunks of the others keep the worker pool busy.
+    std::atomic<sal_Int32> nNextDocument(0);
+    std::mutex aErrorMutex;
+    std::exception_ptr pError;
+    auto aStopBatch = [&]() {
+        // Not the fault of one document: no more are started, and it is rethrown below
+        std::lock_guard<std::mutex> aGuard(aErrorMutex);
+        if (!pError)
+            pError = std::current_exception();
+        nNextDocument = rInputStreams.getLength();
+    };
+    auto aEncryptDocuments = [&]() {
+        for (sal_Int32 i = nNextDocument++; i < rInputStreams.getLength(); i = nNextDocument++)
+        {
+            // Left empty like any other input that fails
+            if (!rInputStreams[i].is())
+                continue;
+            try
+            {
+                pResults[i] = encryptPackage(aDataSpaces, rInputStreams[i], OUString());
+            }
+            catch (const RuntimeException&)
+            {
+                aStopBatch();
+            }
+            catch (const Exception&)
+            {
+                // Left empty: one document that can not be encrypted does not stop the batch
+            }
+            catch (...)
+            {
+                aStopBatch();
+            }
+        }
+    };
+
+    const sal_Int32 nThreads = std::min<sal_Int32>(ENCRYPT_BATCH_DOCUMENTS, rInputStreams.getLength());
+    std::vector<std::thread> aThreads;
+    for (sal_Int32 i = 1; i < nThreads; i++)
+        aThreads.emplace_back(aEncryptDocuments);
+    aEncryptDocuments();
+    for (auto& rThread : aThreads)
+        rThread.join();
+
+    if (pError)
+        std::rethrow_exception(pError);
+    return aResults;
+}
+
+sal_Bool XorPackageEncryption::generateEncryptionKey(const OUString& rPassword)
+{
+    return lcl_unlockKeystream(maKeyInfo, rPassword, maKeystream);
 }
 
 Reference< XInterface > SAL_CALL XorEncryptedDataSpaceService_createInstance(const Reference< XComponentContext > & rxContext) throw(Exception)
@@ -20,14 +20,18 @@
 #ifndef XORENCRYPTEDDATASPACESERVICE_H
 #define XORENCRYPTEDDATASPACESERVICE_H
 
-#include <cppuhelper/implbase3.hxx>
+#include <cppuhelper/implbase4.hxx>
 #include <cppuhelper/implementationentry.hxx>
 
 #include <com/sun/star/lang/XServiceInfo.hpp>
 #include <com/sun/star/lang/XInitialization.hpp>
 #include <com/sun/star/packages/XPackageEncryption.hpp>
+#include <com/sun/star/task/XJob.hpp>
 #include <com/sun/star/uno/XComponentContext.hpp>
 #include <com/sun/star/io/XSequenceOutputStream.hpp>
+#include <com/sun/star/container/XNameAccess.hpp>
+
+#include "TransformEngine.h"
 
 #define XORENCRYPTEDDATASPACESERVICE_IMPLEMENTATIONNAME "com.sun.star.comp.oox.crypto.IMPL.XorEncryptedDataSpace"
 #define XORENCRYPTEDDATASPACESERVICE_SERVICENAME "com.sun.star.comp.oox.crypto.XorEncryptedDataSpace"
@@ -38,12 +42,61 @@ using namespace css::io;
 using namespace css::uno;
 using namespace rtl;
 
-class XorPackageEncryption : public ::cppu::WeakImplHelper3 <css::lang::XInitialization,
+/**
+ * Besides XPackageEncryption the service offers commands on documents it encrypted
+ * through XJob::execute. The "Command" argument selects one:
+ *
+ * ReadDocumentSummary: "InputStream" (the encrypted file) or "Streams" (its OLE
+ *     streams, as passed to readEncryptionInfo) and "Password" if the document
+ *     has one. Returns the entries saved with the DocumentSummary option as a
+ *     sequence of name and bytes, without decrypting the package.
+ * ReadPart: "InputStream" (the encrypted file), "PartName" and "Password" if
+ *     the document has one. Returns the uncompressed bytes of that ZIP entry of
+ *     a document saved with the PartIndex option, decrypting nothing but the
+ *     entry itself.
+ * Rekey: "URLs" of encrypted files, their current "Password" and the
+ *     "NewPassword" (empty for the default key). Changes the key of each file
+ *     in place without decrypting it, returns a success flag per file.
+ * EncryptBatch: "InputStreams" and optionally "EncryptionData" (as passed to
+ *     setupEncryption, otherwise the current setup applies). Returns, per input,
+ *     the streams encrypt would return, or an empty sequence if that one failed.
+ *     RuntimeExceptions and fatal errors end the batch and are rethrown.
+ *     The documents share the DataSpaces streams and run together on the pool.
+ * GetEngineParameters: no arguments. Returns the worker count and, per stream
+ *     profile, the chunk size and parallelism the transform currently uses.
+ * WarmUp: no arguments. Starts the workers and builds the DataSpaces streams of
+ *     the default chain, so that the first save does not wait for them. Meant to
+ *     run in the background.
+ */
+class XorPackageEncryption : public ::cppu::WeakImplHelper4 <css::lang::XInitialization,
                                                   css::lang::XServiceInfo,
-                                                  css::packages::XPackageEncryption>
+                                                  css::packages::XPackageEncryption,
+                                                  css::task::XJob>
 {
     uno::Reference<uno::XComponentContext> mxContext;
+    bool mbProbed;
+    bool mbProbeSucceeded;
+    bool mbWriteDocumentSummary;
+    bool mbWritePartIndex;
+    rtl::OUString msDocumentId;
+    // KeyInfo stream of a password protected package, empty for the default key
+    Sequence<sal_Int8> maKeyInfo;
+    XorKeystream maKeystream;
+    // Stages of the data space, the key stage refers to maKeystream
+    TransformChain maChain;
+
     uno::Reference<io::XInputStream> getStream(const Sequence<NamedValue>& rStreams, const rtl::OUString sStreamName);
+    static Sequence<sal_Int8> getStreamData(const Sequence<NamedValue>& rStreams, const rtl::OUString& sStreamName);
+    Reference<css::container::XNameAccess> openContainer(const Reference<XInputStream>& rxContainer);
+    Sequence<sal_Int8> readPart(const Reference<XInputStream>& rxContainer, const rtl::OUString& rPartName,
+                                const rtl::OUString& rPassword);
+    Sequence<sal_Int8> getTransformFingerprint() const;
+    bool rekeyFile(const rtl::OUString& rURL, const rtl::OUString& rOldPassword, const rtl::OUString& rNewPassword);
+    Sequence<NamedValue> createDataSpacesStreams();
+    Sequence<NamedValue> encryptPackage(const Sequence<NamedValue>& rDataSpaces, const Reference<XInputStream>& rxInputStream,
+                                        const rtl::OUString& rDocumentId);
+    Sequence<Sequence<NamedValue>> encryptBatch(const Sequence<Reference<XInputStream>>& rInputStreams);
+    void warmUp();
 public:
     XorPackageEncryption(const Reference<XComponentContext>& rxContext);
 
@@ -62,16 +115,22 @@ public:
     sal_Bool SAL_CALL checkDataIntegrity() override;
     sal_Bool SAL_CALL decrypt(const Reference<XInputStream>& rxInputStream,
         Reference<XOutputStream>& rxOutputStream) override;
-    Sequence<NamedValue> SAL_CALL createEncryptionData(const rtl::OUString& /*rPassword*/) override;
+    Sequence<NamedValue> SAL_CALL createEncryptionData(const rtl::OUString& rPassword) override;
     sal_Bool SAL_CALL readEncryptionInfo(const Sequence<NamedValue>& aStreams) override;
     sal_Bool SAL_CALL setupEncryption(const Sequence<NamedValue>& rMediaEncData) override;
     Sequence<NamedValue> SAL_CALL encrypt(const Reference<XInputStream>& rxInputStream) override;
-    sal_Bool SAL_CALL generateEncryptionKey(const rtl::OUString& /*password*/) override;
+    sal_Bool SAL_CALL generateEncryptionKey(const rtl::OUString& rPassword) override;
+
+    // XJob
+    Any SAL_CALL execute(const Sequence<NamedValue>& rArguments) override;
 private:
     Reference<XSequenceOutputStream> createStreamDataSpacesDataSpaceMap();
     Reference<XSequenceOutputStream> createStreamDataSpacesDataSpaceInfo();
-    Reference<XSequenceOutputStream> createStreamDataSpacesTransformInfo();
+    Reference<XSequenceOutputStream> createStreamDataSpacesTransformInfo(const TransformStage& rStage);
     Reference<XSequenceOutputStream> createStreamDataSpacesVersion();
+    Reference<XSequenceOutputStream> createStreamDataSpacesDocumentSummary(const Reference<XInputStream>& rxInputStream);
+    Reference<XSequenceOutputStream> createStreamDataSpacesPartIndex(const Reference<XInputStream>& rxInputStream);
+    Reference<XSequenceOutputStream> createStreamDataSpacesKeyInfo(const Sequence<sal_Int8>& rSalt, const Sequence<sal_Int8>& rVerifier);
 };
 
 Reference<XInterface> SAL_CALL XorEncryptedDataSpaceService_createInstance(const Reference<XComponentContext> & rxContext)
@@ -24,6 +24,69 @@
 #include "MyListener.h"
 #include "XorPackageEncryption.h"
 
+#include <cstring>
+#include <mutex>
+
+namespace
+{
+
+typedef css::uno::Reference< css::uno::XInterface > (*CreateFactoryFunction)(
+    const css::uno::Reference< css::lang::XMultiServiceFactory >& xSMGR,
+    const ::rtl::OUString& sImplName, const css::uno::Sequence< ::rtl::OUString >& lNames);
+
+css::uno::Reference< css::uno::XInterface > createListenerFactory(
+    const css::uno::Reference< css::lang::XMultiServiceFactory >& xSMGR,
+    const ::rtl::OUString& sImplName, const css::uno::Sequence< ::rtl::OUString >& lNames)
+{
+    return ::cppu::createSingleFactory(xSMGR, sImplName, MyListener::st_createInstance, lNames);
+}
+
+css::uno::Reference< css::uno::XInterface > createProtocolHandlerFactory(
+    const css::uno::Reference< css::lang::XMultiServiceFactory >&,
+    const ::rtl::OUString& sImplName, const css::uno::Sequence< ::rtl::OUString >& lNames)
+{
+    return ::cppu::createSingleComponentFactory(MyProtocolHandler_createInstance, sImplName, lNames);
+}
+
+css::uno::Reference< css::uno::XInterface > createEncryptionFactory(
+    const css::uno::Reference< css::lang::XMultiServiceFactory >&,
+    const ::rtl::OUString& sImplName, const css::uno::Sequence< ::rtl::OUString >& lNames)
+{
+    return ::cppu::createSingleComponentFactory(XorEncryptedDataSpaceService_createInstance, sImplName, lNames);
+}
+
+struct Implementation
+{
+    const char*           pImplName;
+    const char*           pServiceName;
+    CreateFactoryFunction pCreateFactory;
+};
+
+constexpr Implementation aImplementations[] =
+{
+    { MYLISTENER_IMPLEMENTATIONNAME, MYLISTENER_SERVICENAME, createListenerFactory },
+    { MYPROTOCOLHANDLER_IMPLEMENTATIONNAME, MYPROTOCOLHANDLER_SERVICENAME, createProtocolHandlerFactory },
+    { XORENCRYPTEDDATASPACESERVICE_IMPLEMENTATIONNAME, XORENCRYPTEDDATASPACESERVICE_SERVICENAME, createEncryptionFactory },
+};
+
+constexpr sal_Int32 nImplementations = sizeof(aImplementations) / sizeof(aImplementations[0]);
+
+/// Factories created so far, by index in aImplementations. Never destroyed, as the library is not unloaded.
+struct FactoryCache
+{
+    std::mutex                                  aMutex;
+    css::uno::Reference< css::uno::XInterface > aFactories[nImplementations];
+    void*                                       pServiceManagers[nImplementations] = {};
+};
+
+FactoryCache& getFactoryCache()
+{
+    static FactoryCache* pCache = new FactoryCache();
+    return *pCache;
+}
+
+}
+
 extern "C"
 {
 
@@ -34,27 +97,23 @@ SAL_DLLPUBLIC_EXPORT void* SAL_CALL component_getFactory(const char* pImplName
     if ( !pServiceManager || !pImplName )
         return 0;
 
-    css::uno::Reference< css::uno::XInterface > xFactory  ;
-    css::uno::Reference< css::lang::XMultiServiceFactory >  xSMGR     (reinterpret_cast< css::lang::XMultiServiceFactory* >(pServiceManager), css::uno::UNO_QUERY);
-    ::rtl::OUString                                         sImplName = ::rtl::OUString::createFromAscii(pImplName);
+    sal_Int32 nImplementation = 0;
+    while (nImplementation < nImplementations && strcmp(pImplName, aImplementations[nImplementation].pImplName) != 0)
+        ++nImplementation;
+    if (nImplementation == nImplementations)
+        return 0;
 
-    if (sImplName == MYLISTENER_IMPLEMENTATIONNAME)
-    {
-        css::uno::Sequence< ::rtl::OUString > lNames(1);
-        lNames[0] = MYLISTENER_IMPLEMENTATIONNAME;
-        xFactory = ::cppu::createSingleFactory(xSMGR, sImplName, MyListener::st_createInstance, lNames);
-    }
-    else if (sImplName == MYPROTOCOLHANDLER_IMPLEMENTATIONNAME)
-    {
-        css::uno::Sequence< ::rtl::OUString > lNames(1);
-        lNames[0] = MYPROTOCOLHANDLER_SERVICENAME;
-        xFactory = ::cppu::createSingleComponentFactory(MyProtocolHandler_createInstance, sImplName, lNames);
-    }
-    else if (sImplName == XORENCRYPTEDDATASPACESERVICE_IMPLEMENTATIONNAME)
+    FactoryCache& rCache = getFactoryCache();
+    std::lock_guard< std::mutex > aGuard(rCache.aMutex);
+    css::uno::Reference< css::uno::XInterface >& xFactory = rCache.aFactories[nImplementation];
+    // A factory is bound to the service manager it was created for
+    if (!xFactory.is() || rCache.pServiceManagers[nImplementation] != pServiceManager)
     {
-        css::uno::Sequence< ::rtl::OUString > lNames(1);
-        lNames[0] = XORENCRYPTEDDATASPACESERVICE_SERVICENAME;
-        xFactory = ::cppu::createSingleComponentFactory(XorEncryptedDataSpaceService_createInstance, sImplName, lNames);
+        const Implementation& rImplementation = aImplementations[nImplementation];
+        css::uno::Reference< css::lang::XMultiServiceFactory > xSMGR(reinterpret_cast< css::lang::XMultiServiceFactory* >(pServiceManager), css::uno::UNO_QUERY);
+        css::uno::Sequence< ::rtl::OUString > lNames { ::rtl::OUString::createFromAscii(rImplementation.pServiceName) };
+        xFactory = rImplementation.pCreateFactory(xSMGR, ::rtl::OUString::createFromAscii(rImplementation.pImplName), lNames);
+        rCache.pServiceManagers[nImplementation] = pServiceManager;
     }
 
     if (!xFactory.is())